@@ -1 +1,2 @@
-gcc ../src/databaseADT.c main.c ../queue/queueADT.c ../sqlite/sqlite3.c -lpthread -ldl
\ No newline at end of file
+gcc -o schemagen ../tools/schemagen.c && ./schemagen schema.sql schemaGen ../sqlite/sqlite3.h ../include/databaseADT.h && \
+gcc -DSQLITE_ENABLE_FTS5 ../src/databaseADT.c ../src/resultSetADT.c ../src/faultVfs.c schemaGen.c main.c ../queue/queueADT.c ../queue/concQueueADT.c ../sqlite/sqlite3.c -lpthread -ldl
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../include/databaseADT.h"
+#include "../include/faultVfs.h"
 #include "../queue/queueADT.h"
+#include "schemaGen.h"
 
 /* Restrictions for users */
 #define USER_NAME_MAX_LEN 50
@@ -16,18 +18,20 @@ typedef struct user_t
     char mail[USER_MAIL_MAX_LEN+1];
 } user_t;
 
-/*Static functions prototypes for user's queue*/
-static void *cpyUserQ(void *ptr);
-static void freeUserQ(void *ptr);
-
 /*Queries*/
 void listUsers(databaseADT db, const char *name);
+void listUsersResultSet(databaseADT db, const char *name);
+void listUsersGenerated(databaseADT db, const char *name);
+void listUsersStreamed(databaseADT db, const char *name);
+static int printUserRow(const DBUserRow *row, void *ctx);
+static int printUser(const users_t *row, void *ctx);
 void addUser(databaseADT db, const char *user, const char *password,
         const char *email, const char *name);
 
 int testDB(const char *name);
+int testFaults(void);
 
-int main(void)
+int main(int argc, char *argv[])
 {
     pid_t pid;
     databaseADT db = NULL;
@@ -36,6 +40,10 @@ int main(void)
     char *schema = "./schema.sql";
     FILE *errLog = NULL;
 
+    /* ./a.out faults checks that injected I/O errors are reported */
+    if ( argc > 1 && strcmp(argv[1], "faults") == 0 )
+        return testFaults();
+
     if ( (errLog = fopen("error.log", "w")) == NULL )
     {
         fprintf(stderr, "error.log couldn't be opened\n");
@@ -105,12 +113,86 @@ testDB(const char *name)
     }
 
     listUsers(db, name);
+    listUsersResultSet(db, name);
+    listUsersGenerated(db, name);
+    listUsersStreamed(db, name);
 
     fclose(errLog);
     FreeDatabaseADT(db);
     return 0;
 }
 
+/*
+ * Opens a database through a fault VFS and checks that a short write and
+ * a failed fsync make DBaddUser fail, and that the database works again
+ * once the faults stop.
+ */
+int
+testFaults(void)
+{
+    databaseADT db = NULL;
+    DBOpenOptions options = { "faulty", 0 };
+    faultVfsConfig config;
+    faultVfsStats stats;
+    FILE *errLog;
+    char *path = "./faults.db";
+    int shortWrite, syncFail, after;
+
+    remove(path);
+
+    if ( FaultVfsRegister("faulty", NULL, NULL) != DB_SUCCESS )
+    {
+        fprintf(stderr, "FaultVfsRegister failed\n");
+        return 1;
+    }
+
+    /* The injected errors are expected, keep them out of error.log */
+    if ( (errLog = fopen("faults.log", "w")) == NULL )
+    {
+        fprintf(stderr, "faults.log couldn't be opened\n");
+        FaultVfsUnregister("faulty");
+        return 1;
+    }
+
+    if ( NewDatabaseADTEx(&db, path, errLog, &options) != DB_SUCCESS
+            || DBBuildDatabase(db, "./schema.sql") != DB_SUCCESS )
+    {
+        fprintf(stderr, "Can't create %s\n", path);
+        FreeDatabaseADT(db);
+        FaultVfsUnregister("faulty");
+        fclose(errLog);
+        return 1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.shortWriteEvery = 1;
+    FaultVfsSetConfig("faulty", &config);
+    shortWrite = DBaddUser(db, "shortWrite", "pass", "e@mail.com");
+
+    memset(&config, 0, sizeof(config));
+    config.syncErrorEvery = 1;
+    FaultVfsSetConfig("faulty", &config);
+    syncFail = DBaddUser(db, "syncFail", "pass", "e@mail.com");
+
+    memset(&config, 0, sizeof(config));
+    FaultVfsSetConfig("faulty", &config);
+    after = DBaddUser(db, "after", "pass", "e@mail.com");
+
+    FaultVfsGetStats("faulty", &stats, FALSE);
+
+    printf("Short write: %d, fsync failure: %d, after the faults: %d "
+            "(%lld faults injected)\n", shortWrite, syncFail, after,
+            stats.ioErrors);
+
+    FreeDatabaseADT(db);
+    FaultVfsUnregister("faulty");
+    fclose(errLog);
+    remove(path);
+
+    return ( shortWrite != DB_SUCCESS && syncFail != DB_SUCCESS
+            && after == DB_SUCCESS ) ? 0 : 1;
+}
+
 void
 addUser(databaseADT db, const char *user, const char *password,
         const char *email, const char *name)
@@ -142,9 +224,10 @@ listUsers(databaseADT db, const char *name)
     int ret;
     queueADT queue;
     int i = 1;
-    user_t *uq;
+    user_t uq;
 
-    if ((queue=newQueue(cpyUserQ, freeUserQ)) == NULL)
+    /* Users are stored inside the queue, no allocation per user */
+    if ((queue=newQueueSized(sizeof(user_t))) == NULL)
         return;
 
     ret = DBgetUserQueue(db, queue);
@@ -160,11 +243,10 @@ listUsers(databaseADT db, const char *name)
 
     }
 
-    while ((uq = dequeue(queue)) != NULL )
+    while (dequeueInto(queue, &uq))
     {
         printf("Leyendo %d - user: %s, pass: %s, mail: %s @%s\n",
-                i, uq->name, uq->pass, uq->mail, name);
-        free(uq);
+                i, uq.name, uq.pass, uq.mail, name);
         i++;
         putchar('\n');
     }
@@ -173,24 +255,67 @@ listUsers(databaseADT db, const char *name)
     return;
 }
 
-void *
-cpyUserQ(void *ptr)
+void
+listUsersResultSet(databaseADT db, const char *name)
 {
-    user_t *uq;
+    resultSetADT rs;
+    int i;
 
-    if ((uq = malloc(sizeof(user_t))) == NULL)
-        return NULL;
+    if (DBgetUserResultSet(db, &rs) != DB_SUCCESS)
+    {
+        printf("Database error\n");
+        return;
+    }
 
-    memcpy(uq, ptr, sizeof(user_t));
+    for (i = 0; i < RSRowCount(rs); i++)
+    {
+        printf("Leyendo %d - user: %s, pass: %s, mail: %s @%s\n",
+                i + 1, RSGetText(rs, i, 0), RSGetText(rs, i, 1),
+                RSGetText(rs, i, 2), name);
+        putchar('\n');
+    }
 
-    return (void *)uq;
+    FreeResultSet(rs);
+    return;
 }
 
 void
-freeUserQ(void *ptr)
+listUsersGenerated(databaseADT db, const char *name)
 {
-    if (ptr != NULL)
-        free(ptr);
+    if (DBforEachUsers(db, printUser, (void *)name) != DB_SUCCESS)
+        printf("Database error\n");
 
     return;
 }
+
+void
+listUsersStreamed(databaseADT db, const char *name)
+{
+    /* Users are printed while they are still being read */
+    if (DBStreamUsers(db, 0, 16, printUserRow, (void *)name) != DB_SUCCESS)
+        printf("Database error\n");
+
+    return;
+}
+
+static int
+printUserRow(const DBUserRow *row, void *ctx)
+{
+    printf("Leyendo %lld - user: %s, pass: %.*s, mail: %s @%s\n",
+            row->id, row->user, row->passwordLen,
+            (const char *)row->password, row->mail, (const char *)ctx);
+    putchar('\n');
+
+    return 0;
+}
+
+static int
+printUser(const users_t *row, void *ctx)
+{
+    printf("Leyendo %lld - user: %s, pass: %.*s, mail: %s @%s\n",
+            (long long)row->id, row->user, row->passwordLen,
+            (const char *)row->password, row->email, (const char *)ctx);
+    putchar('\n');
+
+    return 0;
+}
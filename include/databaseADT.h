@@ -1,7 +1,10 @@
 #ifndef __DATABASE_ADT_H__
 #define __DATABASE_ADT_H__
 
+#include <stdio.h>
+
 #include "../queue/queueADT.h"
+#include "resultSetADT.h"
 
 #define FALSE   0
 #define TRUE    !FALSE
@@ -16,9 +19,196 @@
 
 typedef struct databaseCDT *databaseADT;
 
+struct sqlite3_stmt;
+
 typedef enum { DB_SUCCESS = 0, DB_INVALID_ARG, DB_NO_MATCH, DB_NO_MEMORY,
-            DB_INTERNAL_ERROR, DB_ACCESS_DENIED, DB_ALREADY_EXISTS } DB_ERR;
+            DB_INTERNAL_ERROR, DB_ACCESS_DENIED, DB_ALREADY_EXISTS,
+            DB_TIMEOUT, DB_CANCELLED } DB_ERR;
+
+typedef enum { DB_SEARCH_PREFIX = 0, DB_SEARCH_SUBSTRING } DB_SEARCH_MODE;
+
+typedef enum { DB_CHANGE_INSERT = 1, DB_CHANGE_UPDATE, DB_CHANGE_DELETE }
+        DB_CHANGE_OP;
+
+/**
+ * A committed change to a row of the users table. seq starts at 1 and
+ * grows by one with every change published by the database instance.
+*/
+typedef struct DBChange
+{
+    unsigned long long seq;
+    DB_CHANGE_OP op;
+    long long rowid;
+} DBChange;
+
+/**
+ * User received by a DBStreamUsers callback. Pointers are valid until the
+ * callback returns.
+*/
+typedef struct DBUserRow
+{
+    long long id;
+    const char *user;
+    const void *password;
+    int passwordLen;
+    const char *mail;
+} DBUserRow;
+
+/**
+ * DBStreamUsers callback. Returns 0 to go on, anything else to stop.
+*/
+typedef int (*DBUserRowFn)( const DBUserRow *row, void *ctx );
+
+/**
+ * Field of a user open for incremental I/O, see DBBlobOpen.
+*/
+typedef struct blobCDT *blobADT;
+
+/**
+ * Subscription to the changes of a database, see DBSubscribeChanges.
+*/
+typedef struct changeSubCDT *changeSubADT;
 
+/**
+ * Cancellation token. A call given a token fails with DB_CANCELLED as soon
+ * as DBCancel is called on it, from any thread. A token can be used by one
+ * call at a time: a call given a token that another call is using fails
+ * with DB_INVALID_ARG.
+*/
+typedef struct cancelTokenCDT *cancelTokenADT;
+
+/**
+ * Limits of a single call, see the *Ctl functions.
+*/
+typedef struct DBCallCtl
+{
+    long timeoutMs;         /* 0 means no deadline                      */
+    cancelTokenADT cancel;  /* NULL means the call can't be cancelled   */
+} DBCallCtl;
+
+/**
+ * Options for NewDatabaseADTEx.
+*/
+typedef struct DBOpenOptions
+{
+    const char *vfsName;    /* SQLite VFS to open the database with, such */
+                            /* as one registered by FaultVfsRegister.     */
+                            /* NULL uses the default one.                  */
+    int incrementalVacuum;  /* DBBuildDatabase creates the database with   */
+                            /* incremental auto-vacuum, see DBReclaimSpace */
+} DBOpenOptions;
+
+/**
+ * Memory configuration for SQLite, see DBGlobalInit.
+*/
+typedef struct DBMemConfig
+{
+    /* Preallocated page cache. 0 slots uses the system allocator.       */
+    /* A slot size of 0 picks 4096 bytes pages plus SQLite's header.     */
+    int pageCacheSlotSize;
+    int pageCacheSlots;
+
+    /* Lookaside slots of every connection. 0 slots keeps the default.   */
+    int lookasideSlotSize;
+    int lookasideSlots;
+
+    /* Fixed heap for every other allocation. 0 uses the system          */
+    /* allocator. SQLite must be compiled with SQLITE_ENABLE_MEMSYS5.    */
+    int heapSize;
+    int heapMinAlloc;
+
+    /* Disables memory usage tracking, which takes a global mutex on     */
+    /* every allocation. Memory used stats read 0 once disabled.          */
+    int disableMemStatus;
+} DBMemConfig;
+
+/**
+ * Memory usage and high-water marks, see DBGetMemStats.
+*/
+typedef struct DBMemStats
+{
+    /* Process wide */
+    long long memoryUsed;
+    long long memoryHighwater;
+    long long pageCacheUsed;            /* Slots */
+    long long pageCacheHighwater;
+    long long pageCacheOverflow;        /* Bytes that didn't fit the slots */
+    long long pageCacheOverflowHighwater;
+    long long largestAlloc;
+
+    /* Connection, 0 if no connection is given */
+    int lookasideUsed;                  /* Slots */
+    int lookasideHighwater;
+    int lookasideHits;
+    int lookasideMissSize;
+    int lookasideMissFull;
+    int cacheUsed;                      /* Bytes */
+} DBMemStats;
+
+/**
+ * Background checkpointer configuration, see DBStartCheckpointer.
+*/
+typedef struct DBCheckpointConfig
+{
+    int enableWal;          /* Switch the database to WAL mode first     */
+    long intervalMs;        /* Period of the passive checkpoints         */
+    long walSizeLimit;      /* Bytes. A commit that grows the WAL past   */
+                            /* it wakes the checkpointer. 0 disables it. */
+    int idleTicks;          /* Periods without commits from this         */
+                            /* connection after which the WAL is reset   */
+                            /* with a TRUNCATE checkpoint. 0 disables it.*/
+    int reclaimPages;       /* Free pages returned to the file system    */
+                            /* every period without commits, skipped if  */
+                            /* the database is busy. See DBReclaimSpace. */
+                            /* 0 disables it.                            */
+} DBCheckpointConfig;
+
+/**
+ * Checkpointer metrics, see DBGetCheckpointStats.
+*/
+typedef struct DBCheckpointStats
+{
+    long long walSize;          /* Bytes, as of the last checkpoint     */
+    long long checkpoints;      /* Checkpoints run                      */
+    long long incomplete;       /* Checkpoints that couldn't copy every */
+                                /* frame because of readers or writers  */
+    long long truncates;        /* TRUNCATE checkpoints run             */
+    long long lastDurationUs;
+    long long maxDurationUs;
+    long long totalDurationUs;
+    long long reclaimedPages;   /* Free pages removed from the file     */
+} DBCheckpointStats;
+
+/**
+ * Configures the memory used by SQLite. It must be called before any
+ * database instance is created, and at most once until DBGlobalShutdown.
+ *
+ * @param[in]   config  Memory configuration.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBGlobalInit( const DBMemConfig *config );
+
+/**
+ * Shuts SQLite down and releases the memory reserved by DBGlobalInit.
+ * Every database instance must have been destroyed.
+*/
+void DBGlobalShutdown( void );
+
+/**
+ * Retrieves memory usage statistics.
+ *
+ * @param[in]   db      Database instance for the connection statistics.
+ *                      If NULL only process wide statistics are filled.
+ * @param[out]  stats   The statistics.
+ * @param[in]   reset   If TRUE the high-water marks are reset after
+ *                      being read.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBGetMemStats( databaseADT db, DBMemStats *stats, int reset );
 
 /**
  * Creates a new database instance.
@@ -33,6 +223,20 @@ typedef enum { DB_SUCCESS = 0, DB_INVALID_ARG, DB_NO_MATCH, DB_NO_MEMORY,
 */
 DB_ERR NewDatabaseADT( databaseADT *db, const char *dbFile, FILE *errLog );
 
+/**
+ * Creates a new database instance with the given options.
+ *
+ * @param[out]  db      Pointer to the newly created database instance.
+ * @param[in]   dbFile  Path to the database file.
+ * @param[in]   errLog  The stream to which to output error logs.
+ * @param[in]   options Open options. NULL is the same as NewDatabaseADT.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR NewDatabaseADTEx( databaseADT *db, const char *dbFile, FILE *errLog,
+                        const DBOpenOptions *options );
+
 /**
  * Destroys a database instance.
  *
@@ -52,6 +256,37 @@ void FreeDatabaseADT( databaseADT db );
 */
 DB_ERR DBBuildDatabase( databaseADT db, const char *schema );
 
+/**
+ * Returns free pages to the file system, shrinking the database file, in
+ * slices of a few pages each committed on its own, so other connections
+ * can write in between. Only databases created with incremental
+ * auto-vacuum have pages to return, see DBOpenOptions; on any other
+ * database it just reports the free pages.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   maxPages    Maximum number of pages to return, 0 for all.
+ * @param[in]   budgetMs    No new slice is started after budgetMs
+ *                          milliseconds, 0 for no limit.
+ * @param[out]  freePages   If not NULL, set to the number of free pages
+ *                          left in the file.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBReclaimSpace( databaseADT db, int maxPages, long budgetMs,
+                    int *freePages );
+
+/**
+ * Retrieves the number of unused pages in the database file.
+ *
+ * @param[in]   db          The database instance.
+ * @param[out]  freePages   Number of pages in the free-list.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBGetFreePages( databaseADT db, int *freePages );
+
 /**
  * Adds a user to the db.
  *
@@ -66,6 +301,75 @@ DB_ERR DBBuildDatabase( databaseADT db, const char *schema );
 DB_ERR DBaddUser(databaseADT db, const char *user, const char *password,
         const char *mail);
 
+/**
+ * Adds a user to the db or, if it already exists, replaces its password
+ * and mail. Runs a single statement.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   user        Name of the user.
+ * @param[in]   password    New password.
+ * @param[in]   mail        New mail.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBupsertUser(databaseADT db, const char *user, const char *password,
+        const char *mail);
+
+/**
+ * Same as DBupsertUser for count users. The batch runs in a savepoint, so
+ * either every user is stored or none is, also when called inside an open
+ * transaction.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   users       Array of count user names.
+ * @param[in]   passwords   Array of count passwords.
+ * @param[in]   mails       Array of count mails.
+ * @param[in]   count       Number of users.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBupsertUsers(databaseADT db, const char * const *users,
+        const char * const *passwords, const char * const *mails, int count);
+
+/* Fields changed by DBupdateUserFields */
+#define DB_USER_PASSWORD    0x01
+#define DB_USER_MAIL        0x02
+
+/**
+ * Changes some of the fields of an existing user. Runs a single statement.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   user        Name of the user.
+ * @param[in]   fields      Bitwise OR of the DB_USER_* fields to change.
+ * @param[in]   password    New password, ignored unless DB_USER_PASSWORD
+ *                          is in fields.
+ * @param[in]   mail        New mail, ignored unless DB_USER_MAIL is in
+ *                          fields.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_NO_MATCH if the
+ *              user doesn't exist, an appropiate error code otherwise.
+*/
+DB_ERR DBupdateUserFields(databaseADT db, const char *user, int fields,
+        const char *password, const char *mail);
+
+/**
+ * Adds a user to the db with a password of passwordSize zero bytes, to be
+ * written afterwards with DBBlobWrite without holding it all in memory.
+ *
+ * @param[in]   db              The database instance.
+ * @param[in]   user            Name of the user.
+ * @param[in]   passwordSize    Size in bytes of the password.
+ * @param[in]   mail            Mail of the user.
+ * @param[out]  rowid           If not NULL, set to the id of the new user.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBaddUserPrealloc(databaseADT db, const char *user, int passwordSize,
+        const char *mail, long long *rowid);
+
 /**
  * Gets the user list.
  *
@@ -74,7 +378,392 @@ DB_ERR DBaddUser(databaseADT db, const char *user, const char *password,
  *
  * @return      DB_SUCCESS if the operation succeded, an appropiate error
  *              code otherwise.
+ *
+ * @remarks     With a queue of newQueueSized, whose elements must be the
+ *              size of a user, users are copied into the queue. Otherwise
+ *              they are enqueued with enqueueTake, without copying them:
+ *              every element is a user allocated with malloc, so the free
+ *              function of the queue must release it with free.
 */
 DB_ERR DBgetUserQueue(databaseADT db, queueADT queue);
 
+/**
+ * Gets the user list as a result set.
+ *
+ * @param[in]   db          Pointer to the newly created database instance.
+ * @param[out]  result      The new result set with the columns user,
+ *                          password and email of every user.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     The caller is responsible to free the result set with
+ *              FreeResultSet.
+*/
+DB_ERR DBgetUserResultSet(databaseADT db, resultSetADT *result);
+
+/**
+ * Calls fn for every user while the users are still being read: a thread
+ * reads them into a bounded queue, so only queueSize users are held in
+ * memory at a time and reading waits while the queue is full.
+ *
+ * @param[in]   db          The database instance. It must not be used,
+ *                          not even by fn, until the call returns.
+ * @param[in]   consumers   Number of threads calling fn, 0 to call it
+ *                          from the calling thread. With more than one
+ *                          thread users are not processed in order.
+ * @param[in]   queueSize   Maximum number of users read ahead.
+ * @param[in]   fn          Function called with every user.
+ * @param[in]   ctx         Passed to fn.
+ *
+ * @return      DB_SUCCESS if every user was processed, DB_CANCELLED if fn
+ *              stopped the stream, an appropiate error code otherwise.
+ *              Once reading fails or fn stops the stream, the users left
+ *              in the queue are discarded.
+*/
+DB_ERR DBStreamUsers(databaseADT db, int consumers, int queueSize,
+        DBUserRowFn fn, void *ctx);
+
+/**
+ * Creates the indexes used by DBsearchUsers if they don't exist already:
+ * an index on the email column and, if SQLite was compiled with FTS5, a
+ * trigram full text index on user and email kept in sync by triggers.
+ * Runs in a savepoint, so it may be called inside a transaction.
+ * DBsearchUsers never creates them, it scans the table without them.
+ *
+ * @param[in]   db          The database instance.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBEnableUserSearch(databaseADT db);
+
+/**
+ * Searches users by name or email.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   pattern     Text to look for.
+ * @param[in]   mode        DB_SEARCH_PREFIX matches names and emails that
+ *                          start with pattern, case sensitive, with an
+ *                          index range scan. DB_SEARCH_SUBSTRING matches
+ *                          names and emails that contain pattern, case
+ *                          insensitive, with the trigram index. Patterns
+ *                          shorter than 3 characters, or databases
+ *                          without the trigram index, fall back to a
+ *                          full scan.
+ * @param[in]   limit       Maximum number of users returned, 0 for all.
+ * @param[in][out] cursor   Users are returned by increasing id, starting
+ *                          after *cursor, 0 to start from the first one.
+ *                          It is set to the id of the last user returned,
+ *                          to retrieve the next page. May be NULL.
+ * @param[out]  result      The new result set with the columns id, user
+ *                          and email of every match.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     The caller is responsible to free the result set with
+ *              FreeResultSet.
+*/
+DB_ERR DBsearchUsers(databaseADT db, const char *pattern, DB_SEARCH_MODE mode,
+        int limit, long long *cursor, resultSetADT *result);
+
+/**
+ * Same as DBaddUser, bounded by a deadline and a cancellation token.
+ *
+ * @param[in]   ctl     Limits of the call. NULL means no limits.
+ *
+ * @return      DB_TIMEOUT if the deadline expired, DB_CANCELLED if the
+ *              token was cancelled, same as DBaddUser otherwise.
+*/
+DB_ERR DBaddUserCtl(databaseADT db, const char *user, const char *password,
+        const char *mail, const DBCallCtl *ctl);
+
+/**
+ * Same as DBgetUserQueue, bounded by a deadline and a cancellation token.
+ *
+ * @param[in]   ctl     Limits of the call. NULL means no limits.
+ *
+ * @return      DB_TIMEOUT if the deadline expired, DB_CANCELLED if the
+ *              token was cancelled, same as DBgetUserQueue otherwise.
+ *
+ * @remarks     The queue holds the users read before the call was stopped.
+*/
+DB_ERR DBgetUserQueueCtl(databaseADT db, queueADT queue,
+        const DBCallCtl *ctl);
+
+/**
+ * Same as DBgetUserResultSet, bounded by a deadline and a cancellation
+ * token.
+ *
+ * @param[in]   ctl     Limits of the call. NULL means no limits.
+ *
+ * @return      DB_TIMEOUT if the deadline expired, DB_CANCELLED if the
+ *              token was cancelled, same as DBgetUserResultSet otherwise.
+*/
+DB_ERR DBgetUserResultSetCtl(databaseADT db, resultSetADT *result,
+        const DBCallCtl *ctl);
+
+/**
+ * Creates a cancellation token.
+ *
+ * @return      The new token, NULL if there is not enough memory.
+*/
+cancelTokenADT NewCancelToken(void);
+
+/**
+ * Destroys a cancellation token. It must not be in use by any call.
+*/
+void FreeCancelToken(cancelTokenADT token);
+
+/**
+ * Cancels the call using the token, if any, and every later call given
+ * the token until it is reset. Safe to call from any thread.
+*/
+void DBCancel(cancelTokenADT token);
+
+/**
+ * Clears a cancelled token so it can be used again.
+*/
+void ResetCancelToken(cancelTokenADT token);
+
+/**
+ * Enables the query result cache. Listing queries such as DBgetUserQueue
+ * and DBgetUserResultSet keep a copy of their result, so repeated reads of
+ * unchanged data become a memory copy.
+ *
+ * Cached results are invalidated per table when this connection writes to
+ * it, and entirely when another connection or process changes the
+ * database (checked with PRAGMA data_version before every cached read).
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   maxBytes    Maximum memory used by the cache. Least recently
+ *                          used results are dropped to stay below it.
+ *                          0 disables the cache, which is the default.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     Deleting every row of a table with a DELETE without WHERE
+ *              clause doesn't invalidate its cached results, since SQLite
+ *              skips the update hook in that case.
+*/
+DB_ERR DBSetQueryCache(databaseADT db, size_t maxBytes);
+
+/**
+ * Starts a checkpointer thread owned by the database instance.
+ * Automatic checkpoints are disabled on the connection, so inserts never
+ * pay for them; the thread runs passive checkpoints on its own connection
+ * every intervalMs and whenever the WAL grows past walSizeLimit. If
+ * passive checkpoints can't keep up and the WAL reaches four times the
+ * limit, a RESTART checkpoint briefly holds writers back. Once idle, the
+ * WAL is reset with a TRUNCATE checkpoint.
+ *
+ * @param[in]   db      The database instance. It must be in WAL mode or
+ *                      enableWal must be set.
+ * @param[in]   config  Checkpointer configuration.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR DBStartCheckpointer(databaseADT db, const DBCheckpointConfig *config);
+
+/**
+ * Stops the checkpointer thread, if any, and restores automatic
+ * checkpoints. FreeDatabaseADT stops it as well.
+ *
+ * @param[in]   db      The database instance.
+*/
+void DBStopCheckpointer(databaseADT db);
+
+/**
+ * Retrieves the checkpointer metrics.
+ *
+ * @param[in]   db      The database instance.
+ * @param[out]  stats   The checkpointer metrics.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_INVALID_ARG if
+ *              there is no checkpointer running.
+*/
+DB_ERR DBGetCheckpointStats(databaseADT db, DBCheckpointStats *stats);
+
+/**
+ * Enables the slow query log. Statements whose prepare and execution take
+ * longer than the threshold are logged with their expanded SQL, duration,
+ * rows produced, busy retries and EXPLAIN QUERY PLAN output.
+ * Later occurrences of the same query, ignoring its literals, are only
+ * counted and reported by DBFlushSlowQueryLog.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   thresholdMs Threshold in milliseconds. 0 disables the log,
+ *                          which is the default, and removes SQLite's
+ *                          trace hooks.
+ * @param[in]   log         Stream to log to. If NULL the error log is used.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     Query plans are retrieved right before the next query runs,
+ *              or when the log is flushed.
+*/
+DB_ERR DBSetSlowQueryLog(databaseADT db, long thresholdMs, FILE *log);
+
+/**
+ * Logs the pending slow queries and how many times every slow query was
+ * repeated since the last flush.
+ *
+ * @param[in]   db          The database instance.
+*/
+void DBFlushSlowQueryLog(databaseADT db);
+
+/**
+ * Retrieves a prepared statement from the connection's statement cache,
+ * preparing and caching it the first time it is requested. The cache
+ * holds the most recently used statements. Meant for SQL run many times,
+ * such as the statements emitted by schemagen.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   sql         The SQL statement. The cache keeps a copy.
+ * @param[out]  statement   The prepared statement, reset and with no
+ *                          bindings. If the cached statement for sql is
+ *                          still running, a new one is prepared.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     The statement belongs to the cache and must not be
+ *              finalized. It must be reset with DBReleaseStatement once
+ *              the caller is done with it, and not used after that.
+*/
+DB_ERR DBPrepareCached(databaseADT db, const char *sql,
+                    struct sqlite3_stmt **statement);
+
+/**
+ * Steps a statement retrying on busy or lock conditions.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   statement   The statement to step.
+ *
+ * @return      The value returned by sqlite3_step.
+*/
+int DBStepStatement(databaseADT db, struct sqlite3_stmt *statement);
+
+/**
+ * Resets a statement obtained with DBPrepareCached so it can be reused.
+ *
+ * @param[in]   statement   The statement to release.
+*/
+void DBReleaseStatement(struct sqlite3_stmt *statement);
+
+/**
+ * Opens a field of a user for incremental I/O, so big values can be read
+ * and written in chunks. Fields can't grow or shrink through a blob, use
+ * DBaddUserPrealloc to reserve space first.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   column      Column of the users table, e.g. "password".
+ * @param[in]   rowid       Id of the user.
+ * @param[in]   write       TRUE to open the field for writing.
+ * @param[out]  blob        The open blob.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_NO_MATCH if there
+ *              is no such user or column, an appropiate error code
+ *              otherwise.
+ *
+ * @remarks     Outside a transaction, writes are committed when the blob is
+ *              closed. If the row is changed by another statement the blob
+ *              expires and its operations return DB_NO_MATCH.
+*/
+DB_ERR DBBlobOpen(databaseADT db, const char *column, long long rowid,
+        int write, blobADT *blob);
+
+/**
+ * Moves an open blob to the same field of another user, which is faster
+ * than closing it and opening a new one.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_NO_MATCH if there
+ *              is no such user, an appropiate error code otherwise.
+*/
+DB_ERR DBBlobReopen(blobADT blob, long long rowid);
+
+/**
+ * Returns the size in bytes of an open blob, -1 if blob is NULL.
+*/
+int DBBlobSize(blobADT blob);
+
+/**
+ * Reads size bytes of a blob, starting at offset.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_INVALID_ARG if the
+ *              range is past the end of the blob, an appropiate error code
+ *              otherwise.
+*/
+DB_ERR DBBlobRead(blobADT blob, void *buffer, int size, int offset);
+
+/**
+ * Writes size bytes to a blob opened for writing, starting at offset.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_INVALID_ARG if the
+ *              range is past the end of the blob, an appropiate error code
+ *              otherwise.
+*/
+DB_ERR DBBlobWrite(blobADT blob, const void *buffer, int size, int offset);
+
+/**
+ * Closes a blob and frees it.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code if its writes could not be committed.
+*/
+DB_ERR DBBlobClose(blobADT blob);
+
+/**
+ * Subscribes to the inserts, updates and deletes of users. Changes are
+ * captured as statements run and published when their transaction
+ * commits; rolled back changes are never seen. Capture starts with the
+ * first subscription.
+ *
+ * Published changes go to a ring of fixed size shared by every
+ * subscriber, the database never waits for them. A subscriber that falls
+ * behind by more than the size of the ring loses the oldest changes,
+ * DBReadChanges reports how many.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   fromSeq     Sequence number of the first change to read, to
+ *                          resume a previous subscription. 0 to read only
+ *                          the changes published from now on.
+ * @param[out]  sub         The new subscription.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     Subscriptions must be freed with DBUnsubscribeChanges
+ *              before the database instance is freed.
+*/
+DB_ERR DBSubscribeChanges(databaseADT db, unsigned long long fromSeq,
+                        changeSubADT *sub);
+
+/**
+ * Reads the next changes of a subscription, oldest first. Doesn't block
+ * and, unlike the rest of the functions, may be called from any thread
+ * while the database is in use. Each subscription must be read from a
+ * single thread at a time.
+ *
+ * @param[in]   sub         The subscription.
+ * @param[out]  changes     Array where the changes are stored.
+ * @param[in]   max         Size of the changes array.
+ * @param[out]  lost        If not NULL, set to the number of changes
+ *                          overwritten before they could be read. They
+ *                          are the ones right before changes[0].
+ *
+ * @return      The number of changes stored, 0 if there are none.
+*/
+int DBReadChanges(changeSubADT sub, DBChange *changes, int max,
+                unsigned long long *lost);
+
+/**
+ * Frees a subscription.
+*/
+void DBUnsubscribeChanges(changeSubADT sub);
+
 #endif
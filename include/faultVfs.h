@@ -0,0 +1,79 @@
+#ifndef __FAULT_VFS_H__
+#define __FAULT_VFS_H__
+
+#include "databaseADT.h"
+
+/**
+ * Faults injected by a fault VFS. Delays are in microseconds, 0 disables
+ * them. An "every" value of N makes every Nth operation of that kind fail,
+ * 0 disables it.
+*/
+typedef struct faultVfsConfig
+{
+    long readDelayUs;
+    long writeDelayUs;
+    long syncDelayUs;
+    long lockDelayUs;       /* File locks and WAL shared memory locks   */
+    int ioErrorEvery;       /* Reads, writes and syncs fail with IOERR  */
+    int busyEvery;          /* File lock attempts fail with BUSY        */
+    int shortWriteEvery;    /* Writes store half their data and fail    */
+                            /* with FULL, like a full disk              */
+    int syncErrorEvery;     /* Syncs fail with IOERR_FSYNC              */
+} faultVfsConfig;
+
+/**
+ * Operations seen and faults injected by a fault VFS.
+*/
+typedef struct faultVfsStats
+{
+    long long reads;
+    long long writes;
+    long long syncs;
+    long long locks;
+    long long ioErrors;
+    long long busy;
+} faultVfsStats;
+
+
+/**
+ * Registers a VFS that wraps another one and injects delays and errors in
+ * its I/O and locking. Databases use it when opened with NewDatabaseADTEx
+ * and the VFS name in their options. Meant for tests and benchmarks.
+ *
+ * @param[in]   name        Name of the new VFS.
+ * @param[in]   baseName    Name of the wrapped VFS, NULL for the default.
+ * @param[in]   config      Faults to inject. NULL injects none.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+*/
+DB_ERR FaultVfsRegister( const char *name, const char *baseName,
+                        const faultVfsConfig *config );
+
+/**
+ * Unregisters and frees a fault VFS. No database may be using it.
+*/
+void FaultVfsUnregister( const char *name );
+
+/**
+ * Changes the faults injected by a fault VFS. Takes effect right away,
+ * even on databases already open.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_NO_MATCH if there
+ *              is no fault VFS with that name.
+*/
+DB_ERR FaultVfsSetConfig( const char *name, const faultVfsConfig *config );
+
+/**
+ * Retrieves the operations seen by a fault VFS.
+ *
+ * @param[in]   name    Name of the fault VFS.
+ * @param[out]  stats   Operation and fault counters.
+ * @param[in]   reset   If TRUE the counters are reset after being read.
+ *
+ * @return      DB_SUCCESS if the operation succeded, DB_NO_MATCH if there
+ *              is no fault VFS with that name.
+*/
+DB_ERR FaultVfsGetStats( const char *name, faultVfsStats *stats, int reset );
+
+#endif
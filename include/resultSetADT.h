@@ -0,0 +1,105 @@
+#ifndef __RESULT_SET_ADT_H__
+#define __RESULT_SET_ADT_H__
+
+#include <stddef.h>
+
+/**
+ * A result set stores the rows of a query as variable length,
+ * length-prefixed fields packed in a single growable arena.
+ * Rows are accessed by index and the whole set is released with a
+ * single call to FreeResultSet.
+*/
+typedef struct resultSetCDT *resultSetADT;
+
+
+/**
+ * Creates a new, empty result set.
+ *
+ * @param[in]   columns Number of fields in every row.
+ *
+ * @return      The new result set, NULL if there is not enough memory
+ *              or columns is not positive.
+*/
+resultSetADT NewResultSet( int columns );
+
+/**
+ * Destroys a result set and every row stored in it.
+ *
+ * @param[in]   rs      Result set to be destroyed.
+*/
+void FreeResultSet( resultSetADT rs );
+
+/**
+ * Creates a copy of a result set.
+ *
+ * @param[in]   rs      The result set to be copied.
+ *
+ * @return      The new result set, NULL if there is not enough memory.
+*/
+resultSetADT RSClone( resultSetADT rs );
+
+/**
+ * Returns the number of bytes allocated by the result set.
+*/
+size_t RSMemoryUsage( resultSetADT rs );
+
+/**
+ * Appends a row to the result set. Every field is copied into the arena.
+ *
+ * @param[in]   rs      The result set.
+ * @param[in]   fields  Array of RSColumnCount pointers to the field data.
+ *                      A NULL pointer stores an SQL NULL.
+ * @param[in]   lengths Array of RSColumnCount field lengths in bytes.
+ *
+ * @return      1 if the row was stored, 0 otherwise.
+*/
+int RSAppendRow( resultSetADT rs, const void * const *fields,
+                const int *lengths );
+
+/**
+ * Returns the number of rows stored in the result set.
+*/
+int RSRowCount( resultSetADT rs );
+
+/**
+ * Returns the number of fields in every row of the result set.
+*/
+int RSColumnCount( resultSetADT rs );
+
+/**
+ * Retrieves a field of the result set.
+ *
+ * @param[in]   rs      The result set.
+ * @param[in]   row     Row index, starting at 0.
+ * @param[in]   col     Column index, starting at 0.
+ * @param[out]  length  If not NULL, the length in bytes of the field.
+ *
+ * @return      Pointer to the field data, NULL if the field is an SQL NULL
+ *              or the indexes are out of range.
+ *
+ * @remarks     Fields are always followed by a '\0', so text fields can be
+ *              used as C strings. The pointer is valid until the result set
+ *              is modified or freed.
+*/
+const void *RSGetField( resultSetADT rs, int row, int col, int *length );
+
+/**
+ * Same as RSGetField but for text fields.
+*/
+const char *RSGetText( resultSetADT rs, int row, int col );
+
+/**
+ * Retrieves an integer field of the result set. Integers are stored as
+ * their decimal text.
+ *
+ * @param[in]   rs      The result set.
+ * @param[in]   row     Row index, starting at 0.
+ * @param[in]   col     Column index, starting at 0.
+ * @param[out]  value   The value of the field, unchanged on failure.
+ *
+ * @return      1 if the field holds an integer, 0 if it is an SQL NULL,
+ *              not an integer or the indexes are out of range.
+*/
+int RSGetInt64( resultSetADT rs, int row, int col, long long *value );
+
+#endif
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "queueADT.h"
+#include "concQueueADT.h"
+
+/*
+ * Queue benchmark. Prints one CSV line per measure:
+ *
+ *   backing,elements,threads,operation,n,ns_per_op,allocs_per_op
+ *
+ * The queueADT backing is chosen at link time, BENCH_BACKING names it.
+ * Allocations are counted by linking with -Wl,--wrap=malloc and the same
+ * for calloc and realloc, see bench.sh.
+ */
+
+#ifndef BENCH_BACKING
+#define BENCH_BACKING "list"
+#endif
+
+#define BENCH_DEFAULT_N 1000000
+#define BENCH_THREADS 4
+#define BENCH_CONC_SIZE 1024
+#define BENCH_BATCH 32
+
+/* Same layout as the user_t stored by DBgetUserQueue */
+typedef struct record_t
+{
+    char name[51];
+    char pass[51];
+    char mail[51];
+} record_t;
+
+typedef enum { ELEM_STRING = 0, ELEM_STRUCT, ELEM_STRUCT_INLINE } elemMode;
+
+static const char *elemNames[] = { "string", "struct", "struct-inline" };
+
+static atomic_long allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+/* strdup would allocate inside libc, where malloc isn't wrapped */
+static void *
+cpyString(void *ptr)
+{
+    size_t len = strlen(ptr) + 1;
+    char *str;
+
+    if ((str = malloc(len)) != NULL)
+        memcpy(str, ptr, len);
+
+    return str;
+}
+
+static void *
+cpyRecord(void *ptr)
+{
+    record_t *rec;
+
+    if ((rec = malloc(sizeof(record_t))) != NULL)
+        memcpy(rec, ptr, sizeof(record_t));
+
+    return rec;
+}
+
+static void
+freeElem(void *ptr)
+{
+    free(ptr);
+}
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+report(const char *backing, elemMode mode, int threads, const char *op,
+        long n, long long ns, long count)
+{
+    printf("%s,%s,%d,%s,%ld,%.1f,%.4f\n", backing, elemNames[mode], threads,
+            op, n, (double)ns / n, (double)count / n);
+}
+
+static queueADT
+newBenchQueue(elemMode mode)
+{
+    switch (mode)
+    {
+        case ELEM_STRING:
+            return newQueue(cpyString, freeElem);
+
+        case ELEM_STRUCT:
+            return newQueue(cpyRecord, freeElem);
+
+        default:
+            return newQueueSized(sizeof(record_t));
+    }
+}
+
+static void *
+sampleElem(elemMode mode, record_t *rec)
+{
+    memset(rec, 0, sizeof(record_t));
+    strcpy(rec->name, "user name");
+    strcpy(rec->pass, "password");
+    strcpy(rec->mail, "user@example.com");
+
+    return (mode == ELEM_STRING) ? (void *)rec->mail : (void *)rec;
+}
+
+/*
+ * Single threaded: enqueue n elements, then dequeue them, once with the
+ * copying dequeue and once with the move or inline variant.
+ */
+static void
+benchSingle(elemMode mode, long n)
+{
+    queueADT queue;
+    record_t rec, out;
+    void *elem = sampleElem(mode, &rec);
+    long long start;
+    long before, i;
+    long len = 0;
+    int round;
+
+    for (round = 0; round < 2; round++)
+    {
+        if ((queue = newBenchQueue(mode)) == NULL)
+            return;
+
+        before = atomic_load(&allocs);
+        start = nowNs();
+
+        for (i = 0; i < n; i++)
+            enqueue(queue, elem);
+
+        if (round == 0)
+        {
+            report(BENCH_BACKING, mode, 1, "enqueue", n, nowNs() - start,
+                    atomic_load(&allocs) - before);
+
+            /* queueLength used to walk the whole list */
+            start = nowNs();
+
+            for (i = 0; i < 1000; i++)
+                len += queueLength(queue);
+
+            report(BENCH_BACKING, mode, 1, "queueLength", 1000,
+                    nowNs() - start, 0);
+        }
+
+        before = atomic_load(&allocs);
+        start = nowNs();
+
+        for (i = 0; i < n; i++)
+        {
+            if (round == 0)
+                free(dequeue(queue));
+            else if (mode == ELEM_STRUCT_INLINE)
+                dequeueInto(queue, &out);
+            else
+                free(dequeueTake(queue));
+        }
+
+        report(BENCH_BACKING, mode, 1,
+                (round == 0) ? "dequeue"
+                : (mode == ELEM_STRUCT_INLINE) ? "dequeueInto" : "dequeueTake",
+                n, nowNs() - start, atomic_load(&allocs) - before);
+
+        freeQueue(queue);
+    }
+
+    if (len != 1000 * n)
+        fprintf(stderr, "queueLength mismatch\n");
+}
+
+typedef struct benchShared
+{
+    elemMode mode;
+    long perThread;
+    queueADT queue;             /* Guarded by lock */
+    pthread_mutex_t lock;
+    concQueueADT conc;
+    atomic_long consumed;
+    long total;
+} benchShared;
+
+static void *
+lockedProducer(void *ptr)
+{
+    benchShared *sh = ptr;
+    record_t rec;
+    void *elem = sampleElem(sh->mode, &rec);
+    long i;
+
+    for (i = 0; i < sh->perThread; i++)
+    {
+        pthread_mutex_lock(&sh->lock);
+        enqueue(sh->queue, elem);
+        pthread_mutex_unlock(&sh->lock);
+    }
+
+    return NULL;
+}
+
+static void *
+lockedConsumer(void *ptr)
+{
+    benchShared *sh = ptr;
+    record_t out;
+    void *elem;
+    int got;
+
+    while (atomic_load(&sh->consumed) < sh->total)
+    {
+        pthread_mutex_lock(&sh->lock);
+        got = dequeueInto(sh->queue,
+                (sh->mode == ELEM_STRUCT_INLINE) ? (void *)&out : &elem);
+        pthread_mutex_unlock(&sh->lock);
+
+        if (!got)
+            continue;
+
+        if (sh->mode != ELEM_STRUCT_INLINE)
+            free(elem);
+
+        atomic_fetch_add(&sh->consumed, 1);
+    }
+
+    return NULL;
+}
+
+static void *
+concProducer(void *ptr)
+{
+    benchShared *sh = ptr;
+    record_t rec;
+    void *elem = sampleElem(sh->mode, &rec);
+    void *batch[BENCH_BATCH];
+    long i;
+    int j, k;
+
+    for (i = 0; i < sh->perThread; i += BENCH_BATCH)
+    {
+        for (j = 0; j < BENCH_BATCH; j++)
+            batch[j] = (sh->mode == ELEM_STRING) ? cpyString(elem)
+                        : cpyRecord(elem);
+
+        for (j = 0; j < BENCH_BATCH; j += k)
+            if ((k = concEnqueueBatch(sh->conc, batch + j,
+                            BENCH_BATCH - j)) == 0)
+            {
+                concEnqueue(sh->conc, batch[j]);
+                k = 1;
+            }
+    }
+
+    return NULL;
+}
+
+static void *
+concConsumer(void *ptr)
+{
+    benchShared *sh = ptr;
+    void *batch[BENCH_BATCH];
+    int i, k;
+
+    for (;;)
+    {
+        if ((k = concDequeueBatch(sh->conc, batch, BENCH_BATCH)) == 0)
+        {
+            if (!concDequeue(sh->conc, &batch[0]))
+                break;
+            k = 1;
+        }
+
+        for (i = 0; i < k; i++)
+            free(batch[i]);
+    }
+
+    return NULL;
+}
+
+/*
+ * BENCH_THREADS producers and as many consumers moving n elements, either
+ * through a queueADT behind a mutex or through a concQueueADT.
+ */
+static void
+benchThreads(elemMode mode, long n, int concurrent)
+{
+    pthread_t producers[BENCH_THREADS], consumers[BENCH_THREADS];
+    benchShared sh;
+    long long start;
+    long before;
+    int i;
+
+    sh.mode = mode;
+    sh.perThread = n / BENCH_THREADS / BENCH_BATCH * BENCH_BATCH;
+    sh.total = sh.perThread * BENCH_THREADS;
+    atomic_init(&sh.consumed, 0);
+    pthread_mutex_init(&sh.lock, NULL);
+
+    /* The concurrent queue adopts pointers, copies are made outside */
+    sh.queue = concurrent ? NULL : newBenchQueue(mode);
+    sh.conc = concurrent ? newConcQueue(BENCH_CONC_SIZE, NULL, freeElem)
+                : NULL;
+
+    before = atomic_load(&allocs);
+    start = nowNs();
+
+    for (i = 0; i < BENCH_THREADS; i++)
+    {
+        pthread_create(&consumers[i], NULL,
+                concurrent ? concConsumer : lockedConsumer, &sh);
+        pthread_create(&producers[i], NULL,
+                concurrent ? concProducer : lockedProducer, &sh);
+    }
+
+    for (i = 0; i < BENCH_THREADS; i++)
+        pthread_join(producers[i], NULL);
+
+    if (concurrent)
+        concClose(sh.conc);
+
+    for (i = 0; i < BENCH_THREADS; i++)
+        pthread_join(consumers[i], NULL);
+
+    report(concurrent ? "conc" : BENCH_BACKING "+mutex", mode,
+            2 * BENCH_THREADS, "enqueue+dequeue", sh.total, nowNs() - start,
+            atomic_load(&allocs) - before);
+
+    if (concurrent)
+        freeConcQueue(sh.conc);
+    else
+        freeQueue(sh.queue);
+
+    pthread_mutex_destroy(&sh.lock);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long n = (argc > 1) ? atol(argv[1]) : BENCH_DEFAULT_N;
+    elemMode mode;
+
+    if (n <= 0)
+    {
+        fprintf(stderr, "usage: %s [elements]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc <= 2 || strcmp(argv[2], "-noheader") != 0)
+        printf("backing,elements,threads,operation,n,ns_per_op,allocs_per_op\n");
+
+    for (mode = ELEM_STRING; mode <= ELEM_STRUCT_INLINE; mode++)
+    {
+        benchSingle(mode, n);
+        benchThreads(mode, n, 0);
+
+#ifdef BENCH_CONC
+        /* Inline elements don't apply, it stores pointers */
+        if (mode != ELEM_STRUCT_INLINE)
+            benchThreads(mode, n, 1);
+#endif
+    }
+
+    return 0;
+}
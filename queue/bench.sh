@@ -0,0 +1,8 @@
+#!/bin/sh
+# Builds the queue benchmark once per queueADT backing and prints the
+# results of all of them as a single CSV. Usage: ./bench.sh [elements]
+WRAP="-Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc"
+
+gcc -O2 -DBENCH_BACKING='"list"' -DBENCH_CONC -o bench_list bench.c queueADT.c concQueueADT.c $WRAP -lpthread && \
+gcc -O2 -DBENCH_BACKING='"ring"' -o bench_ring bench.c queueRingADT.c concQueueADT.c $WRAP -lpthread && \
+./bench_list "$@" && ./bench_ring "${1:-1000000}" -noheader
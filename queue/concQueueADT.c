@@ -0,0 +1,404 @@
+/**
+*   @file concQueueADT.c
+*   Implementacion de una cola acotada para varios productores y varios
+*   consumidores (algoritmo de D. Vyukov).
+*   Cada celda tiene un numero de secuencia que dice si esta libre o llena
+*   para la vuelta actual del arreglo. Productores y consumidores reservan
+*   posiciones con un compare-and-swap sobre su indice y despues publican
+*   la celda con su numero de secuencia. Las operaciones bloqueantes solo
+*   usan el mutex para dormir cuando no pueden avanzar.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "concQueueADT.h"
+
+/* Reintentos antes de dormir en las operaciones bloqueantes */
+#define CONC_SPIN 64
+
+/* Elementos que concEnqueueBatch copia por llamada */
+#define CONC_BATCH_COPY 64
+
+/**
+*	\struct cellT
+* 	Celda del arreglo.
+* 	@param seq Posicion para la que la celda esta libre (seq == pos) o
+* 	llena (seq == pos + 1).
+* 	@param data Elemento.
+*/ 
+typedef struct cellT
+{
+	_Atomic size_t seq;
+	queueElemT data;
+} cellT;
+
+/**
+*	\struct concQueueCDT
+* 	Header de la cola. Los indices estan en lineas de cache distintas
+* 	para que productores y consumidores no se molesten.
+* 	@param cells Arreglo de celdas.
+* 	@param mask Tamanio del arreglo menos 1.
+* 	@param enqPos Proxima posicion a encolar.
+* 	@param deqPos Proxima posicion a desencolar.
+* 	@param closed Distinto de 0 si la cola esta cerrada.
+* 	@param waiting Threads durmiendo en lock.
+*/ 
+struct concQueueCDT
+{
+	cellT *cells;
+	size_t mask;
+	deepCopyT deepCpy;
+	freeCpyT freeCpy;
+	
+	_Alignas(64) _Atomic size_t enqPos;
+	_Alignas(64) _Atomic size_t deqPos;
+	
+	_Alignas(64) _Atomic int closed;
+	_Atomic int waiting;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/**
+*	\fn reserve
+*   Reserva hasta n posiciones consecutivas de un indice. Una celda se
+*   puede tomar si su secuencia es la posicion mas offset (0 para encolar,
+*   1 para desencolar).
+*   @return La cantidad de posiciones reservadas, a partir de *pos.
+*/
+static int reserve( concQueueADT queue, _Atomic size_t *index, size_t offset, int n, size_t *pos );
+
+/**
+*	\fn wakeUp
+*   Despierta a los threads que esperan, si hay alguno.
+*/
+static void wakeUp( concQueueADT queue );
+
+/**
+*	\fn waitFor
+*   Espera a que op se pueda hacer o a que se cierre la cola.
+*   @return 1 si op se hizo, 0 si la cola se cerro antes.
+*/
+static int waitFor( concQueueADT queue, int (*op)( concQueueADT, queueElemT * ), queueElemT *elem, int isDequeue );
+
+static int reserve( concQueueADT queue, _Atomic size_t *index, size_t offset, int n, size_t *pos )
+{
+	size_t p, seq;
+	int k;
+	
+	p = atomic_load_explicit( index, memory_order_relaxed );
+	
+	for ( ;; )
+	{
+		/* Las celdas libres solo pueden pasar a estar disponibles, */
+		/* nadie mas las toma sin mover antes el indice             */
+		for ( k = 0 ; k < n ; k++ )
+		{
+			seq = atomic_load_explicit( &queue->cells[( p + k ) & queue->mask].seq, memory_order_acquire );
+			
+			if ( seq != p + k + offset )
+				break;
+		}
+		
+		if ( k == 0 )
+		{
+			/* Otro thread ya la tomo: hay que releer el indice */
+			seq = atomic_load_explicit( &queue->cells[p & queue->mask].seq, memory_order_acquire );
+			
+			if ( (intptr_t) ( seq - ( p + offset ) ) < 0 )
+				return 0;
+			
+			p = atomic_load_explicit( index, memory_order_relaxed );
+			continue;
+		}
+		
+		if ( atomic_compare_exchange_weak_explicit( index, &p, p + k, memory_order_relaxed, memory_order_relaxed ) )
+		{
+			*pos = p;
+			return k;
+		}
+	}
+}
+
+static void wakeUp( concQueueADT queue )
+{
+	/* Se ordena con el incremento de waiting en waitFor */
+	atomic_thread_fence( memory_order_seq_cst );
+	
+	if ( atomic_load_explicit( &queue->waiting, memory_order_relaxed ) > 0 )
+	{
+		pthread_mutex_lock( &queue->lock );
+		pthread_cond_broadcast( &queue->cond );
+		pthread_mutex_unlock( &queue->lock );
+	}
+}
+
+static int tryEnqueueOne( concQueueADT queue, queueElemT *elem )
+{
+	size_t pos;
+	cellT *cell;
+	
+	if ( atomic_load_explicit( &queue->closed, memory_order_relaxed ) )
+		return 0;
+	
+	if ( reserve( queue, &queue->enqPos, 0, 1, &pos ) == 0 )
+		return 0;
+	
+	cell = &queue->cells[pos & queue->mask];
+	cell->data = *elem;
+	atomic_store_explicit( &cell->seq, pos + 1, memory_order_release );
+	
+	return 1;
+}
+
+static int tryDequeueOne( concQueueADT queue, queueElemT *elem )
+{
+	size_t pos;
+	cellT *cell;
+	
+	if ( reserve( queue, &queue->deqPos, 1, 1, &pos ) == 0 )
+		return 0;
+	
+	cell = &queue->cells[pos & queue->mask];
+	*elem = cell->data;
+	atomic_store_explicit( &cell->seq, pos + queue->mask + 1, memory_order_release );
+	
+	return 1;
+}
+
+static int waitFor( concQueueADT queue, int (*op)( concQueueADT, queueElemT * ), queueElemT *elem, int isDequeue )
+{
+	int i, done;
+	
+	for ( i = 0 ; i < CONC_SPIN ; i++ )
+	{
+		if ( op( queue, elem ) )
+			return 1;
+		
+		if ( atomic_load_explicit( &queue->closed, memory_order_acquire ) )
+			return isDequeue && op( queue, elem );
+	}
+	
+	pthread_mutex_lock( &queue->lock );
+	atomic_fetch_add_explicit( &queue->waiting, 1, memory_order_seq_cst );
+	atomic_thread_fence( memory_order_seq_cst );
+	
+	for ( ;; )
+	{
+		if ( ( done = op( queue, elem ) ) )
+			break;
+		
+		/* Cerrada: ya no se encola, pero se vacia lo que quedo */
+		if ( atomic_load_explicit( &queue->closed, memory_order_acquire ) )
+		{
+			done = isDequeue && op( queue, elem );
+			break;
+		}
+		
+		pthread_cond_wait( &queue->cond, &queue->lock );
+	}
+	
+	atomic_fetch_sub_explicit( &queue->waiting, 1, memory_order_relaxed );
+	pthread_mutex_unlock( &queue->lock );
+	
+	return done;
+}
+
+concQueueADT newConcQueue( int capacity, deepCopyT dpcpy, freeCpyT freecpy )
+{
+	concQueueADT queue;
+	size_t size, i;
+	
+	if ( capacity <= 0 || capacity > ( 1 << 30 ) )
+		return NULL;
+	
+	for ( size = 2 ; size < (size_t) capacity ; size *= 2 )
+		;
+	
+	if ( ( queue = malloc( sizeof(struct concQueueCDT) ) ) == NULL )
+		return NULL;
+	
+	if ( ( queue->cells = malloc( size * sizeof(cellT) ) ) == NULL )
+	{
+		free( queue );
+		return NULL;
+	}
+	
+	for ( i = 0 ; i < size ; i++ )
+		atomic_init( &queue->cells[i].seq, i );
+	
+	queue->mask = size - 1;
+	queue->deepCpy = dpcpy;
+	queue->freeCpy = freecpy;
+	atomic_init( &queue->enqPos, 0 );
+	atomic_init( &queue->deqPos, 0 );
+	atomic_init( &queue->closed, 0 );
+	atomic_init( &queue->waiting, 0 );
+	pthread_mutex_init( &queue->lock, NULL );
+	pthread_cond_init( &queue->cond, NULL );
+	
+	return queue;
+}
+
+int concTryEnqueue( concQueueADT queue, queueElemT elem )
+{
+	queueElemT cp = ( queue->deepCpy != NULL ) ? queue->deepCpy( elem ) : elem;
+	
+	if ( cp == NULL && elem != NULL )
+		return 0;
+	
+	if ( !tryEnqueueOne( queue, &cp ) )
+	{
+		if ( queue->deepCpy != NULL && queue->freeCpy != NULL )
+			queue->freeCpy( cp );
+		return 0;
+	}
+	
+	wakeUp( queue );
+	
+	return 1;
+}
+
+int concEnqueue( concQueueADT queue, queueElemT elem )
+{
+	queueElemT cp = ( queue->deepCpy != NULL ) ? queue->deepCpy( elem ) : elem;
+	
+	if ( cp == NULL && elem != NULL )
+		return 0;
+	
+	if ( !waitFor( queue, tryEnqueueOne, &cp, 0 ) )
+	{
+		if ( queue->deepCpy != NULL && queue->freeCpy != NULL )
+			queue->freeCpy( cp );
+		return 0;
+	}
+	
+	wakeUp( queue );
+	
+	return 1;
+}
+
+int concTryDequeue( concQueueADT queue, queueElemT *elem )
+{
+	if ( !tryDequeueOne( queue, elem ) )
+		return 0;
+	
+	wakeUp( queue );
+	
+	return 1;
+}
+
+int concDequeue( concQueueADT queue, queueElemT *elem )
+{
+	if ( !waitFor( queue, tryDequeueOne, elem, 1 ) )
+		return 0;
+	
+	wakeUp( queue );
+	
+	return 1;
+}
+
+int concEnqueueBatch( concQueueADT queue, const queueElemT *elems, int n )
+{
+	queueElemT copies[CONC_BATCH_COPY];
+	const queueElemT *src = elems;
+	size_t pos;
+	cellT *cell;
+	int i, k = 0;
+	
+	if ( n <= 0 || atomic_load_explicit( &queue->closed, memory_order_relaxed ) )
+		return 0;
+	
+	/* Se copia antes de reservar: los consumidores esperan cada celda */
+	/* reservada hasta que se publica                                   */
+	if ( queue->deepCpy != NULL )
+	{
+		if ( n > CONC_BATCH_COPY )
+			n = CONC_BATCH_COPY;
+		
+		for ( i = 0 ; i < n ; i++ )
+			if ( ( copies[i] = queue->deepCpy( elems[i] ) ) == NULL && elems[i] != NULL )
+				break;
+		
+		n = i;
+		src = copies;
+	}
+	
+	if ( n > 0 )
+		k = reserve( queue, &queue->enqPos, 0, n, &pos );
+	
+	for ( i = 0 ; i < k ; i++ )
+	{
+		cell = &queue->cells[( pos + i ) & queue->mask];
+		cell->data = src[i];
+		atomic_store_explicit( &cell->seq, pos + i + 1, memory_order_release );
+	}
+	
+	/* Las copias que no entraron */
+	if ( queue->deepCpy != NULL && queue->freeCpy != NULL )
+		for ( i = k ; i < n ; i++ )
+			queue->freeCpy( copies[i] );
+	
+	if ( k > 0 )
+		wakeUp( queue );
+	
+	return k;
+}
+
+int concDequeueBatch( concQueueADT queue, queueElemT *elems, int n )
+{
+	size_t pos;
+	cellT *cell;
+	int i, k;
+	
+	if ( n <= 0 || ( k = reserve( queue, &queue->deqPos, 1, n, &pos ) ) == 0 )
+		return 0;
+	
+	for ( i = 0 ; i < k ; i++ )
+	{
+		cell = &queue->cells[( pos + i ) & queue->mask];
+		elems[i] = cell->data;
+		atomic_store_explicit( &cell->seq, pos + i + queue->mask + 1, memory_order_release );
+	}
+	
+	wakeUp( queue );
+	
+	return k;
+}
+
+void concClose( concQueueADT queue )
+{
+	atomic_store_explicit( &queue->closed, 1, memory_order_release );
+	
+	pthread_mutex_lock( &queue->lock );
+	pthread_cond_broadcast( &queue->cond );
+	pthread_mutex_unlock( &queue->lock );
+}
+
+int concQueueLength( concQueueADT queue )
+{
+	size_t enq, deq;
+	
+	deq = atomic_load_explicit( &queue->deqPos, memory_order_relaxed );
+	enq = atomic_load_explicit( &queue->enqPos, memory_order_relaxed );
+	
+	return ( enq > deq ) ? (int) ( enq - deq ) : 0;
+}
+
+void freeConcQueue( concQueueADT queue )
+{
+	queueElemT elem;
+	
+	while ( tryDequeueOne( queue, &elem ) )
+		if ( queue->freeCpy != NULL )
+			queue->freeCpy( elem );
+	
+	pthread_mutex_destroy( &queue->lock );
+	pthread_cond_destroy( &queue->cond );
+	free( queue->cells );
+	free( queue );
+	
+	return;
+}
@@ -0,0 +1,125 @@
+/**
+*   @file concQueueADT.h
+*   Interface para concQueueADT.c.
+* 	Cola acotada para varios productores y varios consumidores, sin locks
+* 	en las operaciones que no esperan. Sirve para pasar elementos entre
+* 	threads sin un mutex externo.
+*/
+
+#ifndef _CONC_QUEUE_ADT_H_
+#define _CONC_QUEUE_ADT_H_
+
+#include "queueADT.h"
+
+/**
+*	\typedef concQueueADT
+* 	Puntero al tipo concreto de dato de la cola concurrente.
+*/ 
+typedef struct concQueueCDT *concQueueADT;
+
+
+/**
+*	\fn newConcQueue
+*   Creacion de la cola. Al encolar se guarda una copia del elemento hecha
+*   con dpcpy; al desencolar se entrega esa copia sin volver a copiarla y
+*   el llamador debe liberarla con freecpy.
+*   @param capacity Cantidad maxima de elementos, se redondea a la
+*   siguiente potencia de 2.
+*   @param dpcpy Funcion de copia. NULL guarda el puntero recibido, la cola
+*   se adueña del elemento.
+*   @param freecpy Funcion de liberacion de los elementos que quedan en la
+*   cola al liberarla. NULL no los libera.
+*   @return concQueueADT puntero al CDT si todo esta bien, NULL en caso
+*   contrario.
+*/
+concQueueADT newConcQueue ( int capacity, deepCopyT dpcpy, freeCpyT freecpy );
+
+/**
+*	\fn concTryEnqueue
+*   Encola un elemento si hay lugar, sin esperar.
+*   @param queue La cola que se creo con newConcQueue.
+*   @param elem Elemento a encolar.
+*   @return 1 si se encolo, 0 si la cola esta llena o cerrada o si no se
+*   pudo copiar el elemento.
+*/
+int concTryEnqueue ( concQueueADT queue, queueElemT elem );
+
+/**
+*	\fn concEnqueue
+*   Encola un elemento, esperando mientras la cola este llena.
+*   @param queue La cola que se creo con newConcQueue.
+*   @param elem Elemento a encolar.
+*   @return 1 si se encolo, 0 si la cola esta cerrada o si no se pudo
+*   copiar el elemento.
+*/
+int concEnqueue ( concQueueADT queue, queueElemT elem );
+
+/**
+*	\fn concTryDequeue
+*   Desencola un elemento si hay alguno, sin esperar.
+*   @param queue La cola que se creo con newConcQueue.
+*   @param elem Donde se guarda el elemento desencolado.
+*   @return 1 si se desencolo, 0 si la cola esta vacia.
+*/
+int concTryDequeue ( concQueueADT queue, queueElemT *elem );
+
+/**
+*	\fn concDequeue
+*   Desencola un elemento, esperando mientras la cola este vacia.
+*   @param queue La cola que se creo con newConcQueue.
+*   @param elem Donde se guarda el elemento desencolado.
+*   @return 1 si se desencolo, 0 si la cola esta cerrada y vacia.
+*/
+int concDequeue ( concQueueADT queue, queueElemT *elem );
+
+/**
+*	\fn concEnqueueBatch
+*   Encola hasta n elementos, en orden, reservando todos los lugares con
+*   una sola operacion atomica. No espera. Si la cola copia los elementos,
+*   copia a lo sumo 64 por llamada, antes de reservar, y se detiene en la
+*   primera copia que falle.
+*   @param queue La cola que se creo con newConcQueue.
+*   @param elems Arreglo de elementos a encolar.
+*   @param n Cantidad de elementos.
+*   @return Cantidad de elementos encolados, los primeros del arreglo. 0 si
+*   la cola esta llena o cerrada.
+*/
+int concEnqueueBatch ( concQueueADT queue, const queueElemT *elems, int n );
+
+/**
+*	\fn concDequeueBatch
+*   Desencola hasta n elementos, en orden, con una sola operacion atomica.
+*   No espera.
+*   @param queue La cola que se creo con newConcQueue.
+*   @param elems Arreglo donde se guardan los elementos desencolados.
+*   @param n Tamanio del arreglo.
+*   @return Cantidad de elementos desencolados, 0 si la cola esta vacia.
+*/
+int concDequeueBatch ( concQueueADT queue, queueElemT *elems, int n );
+
+/**
+*	\fn concClose
+*   Cierra la cola: no se puede encolar mas y los que esperan se despiertan.
+*   Los elementos que quedan se pueden seguir desencolando.
+*   @param queue La cola que se creo con newConcQueue.
+*/
+void concClose ( concQueueADT queue );
+
+/**
+*	\fn concQueueLength
+*   Determina la extension de la cola. Con otros threads usando la cola es
+*   solo aproximada.
+*   @param queue La cola que se creo con newConcQueue.
+*   @return int extension de la cola.
+*/
+int concQueueLength ( concQueueADT queue );
+
+/**
+*	\fn freeConcQueue
+*   Libera la cola y los elementos que queden. Ningun thread puede estar
+*   usandola.
+*   @param queue La cola que se creo con newConcQueue.
+*/
+void freeConcQueue ( concQueueADT queue );
+
+#endif
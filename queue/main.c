@@ -1,10 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "queueADT.h"
+#include "concQueueADT.h"
+
+/* concQueueADT stress test */
+#define STRESS_PRODUCERS 4
+#define STRESS_CONSUMERS 4
+#define STRESS_ITEMS 200000
+#define STRESS_BATCH 16
 
 void *cpyStr(void *ptr);
 void freeStr(void *ptr);
+int stressConcQueue(void);
 
 void *
 cpyStr(void *ptr)
@@ -27,6 +37,7 @@ int main(void)
     char *str1 = "First";
     char *str2 = "Second";
     char *str3 = "Third";
+    char *str4;
     queueADT queue;
 
     queue = newQueue(cpyStr, freeStr);
@@ -40,24 +51,170 @@ int main(void)
     if ((enqueue(queue, str3))==0)
         printf("Error\n");
 
-    str3 = dequeue(queue);
-    printf("%s\n", str3);
     str1 = dequeue(queue);
     printf("%s\n", str1);
     str2 = dequeue(queue);
     printf("%s\n", str2);
+    str3 = dequeue(queue);
+    printf("%s\n", str3);
 
-    str2 = dequeue(queue);
+    str4 = dequeue(queue);
 
-    if (str2 == NULL)
-        printf("str2 doesn't exist\n");
+    if (str4 == NULL)
+        printf("str4 doesn't exist\n");
     else
-        printf("%s\n", str2);
+        printf("%s\n", str4);
 
     free(str1);
     free(str2);
     free(str3);
+    free(str4);
     freeQueue(queue);
-    return 0;
+
+    return stressConcQueue();
+}
+
+typedef struct stressArg
+{
+    concQueueADT queue;
+    int id;
+    unsigned char *seen;    /* One flag per item of every producer */
+    long received;
+    int errors;
+} stressArg;
+
+/* Items are the producer id and a sequence number packed in a pointer */
+#define STRESS_ITEM(p, n) ((queueElemT)(uintptr_t)((p) * STRESS_ITEMS + (n)))
+
+static void *
+stressProducer(void *ptr)
+{
+    stressArg *arg = ptr;
+    queueElemT batch[STRESS_BATCH];
+    int n = 0, i, k;
+
+    while (n < STRESS_ITEMS)
+    {
+        /* Alternate single and batch enqueues */
+        if (n % (2 * STRESS_BATCH) == 0 || STRESS_ITEMS - n < STRESS_BATCH)
+        {
+            concEnqueue(arg->queue, STRESS_ITEM(arg->id, n));
+            n++;
+            continue;
+        }
+
+        for (i = 0; i < STRESS_BATCH; i++)
+            batch[i] = STRESS_ITEM(arg->id, n + i);
+
+        for (i = 0; i < STRESS_BATCH; i += k)
+            if ((k = concEnqueueBatch(arg->queue, batch + i,
+                            STRESS_BATCH - i)) == 0)
+            {
+                concEnqueue(arg->queue, batch[i]);
+                k = 1;
+            }
+
+        n += STRESS_BATCH;
+    }
+
+    return NULL;
+}
+
+static void
+stressCheck(stressArg *arg, queueElemT elem, long *last)
+{
+    uintptr_t item = (uintptr_t)elem;
+    int producer = item / STRESS_ITEMS;
+    long n = item % STRESS_ITEMS;
+
+    /* Every item is seen once, and in order for a given producer */
+    if (producer >= STRESS_PRODUCERS || n <= last[producer]
+            || arg->seen[item]++ != 0)
+        arg->errors++;
+
+    last[producer] = n;
+    arg->received++;
+}
+
+static void *
+stressConsumer(void *ptr)
+{
+    stressArg *arg = ptr;
+    queueElemT batch[STRESS_BATCH], elem;
+    long last[STRESS_PRODUCERS];
+    int i, k;
+
+    for (i = 0; i < STRESS_PRODUCERS; i++)
+        last[i] = -1;
+
+    for (;;)
+    {
+        if ((k = concDequeueBatch(arg->queue, batch, STRESS_BATCH)) > 0)
+        {
+            for (i = 0; i < k; i++)
+                stressCheck(arg, batch[i], last);
+        }
+        else if (concDequeue(arg->queue, &elem))
+            stressCheck(arg, elem, last);
+        else
+            break;
+    }
+
+    return NULL;
+}
+
+int
+stressConcQueue(void)
+{
+    pthread_t producers[STRESS_PRODUCERS], consumers[STRESS_CONSUMERS];
+    stressArg pArgs[STRESS_PRODUCERS], cArgs[STRESS_CONSUMERS];
+    unsigned char *seen;
+    long received = 0;
+    int i, errors = 0;
+
+    if ((seen = calloc(STRESS_PRODUCERS, STRESS_ITEMS)) == NULL)
+        return 1;
+
+    /* Small, so producers and consumers block often */
+    pArgs[0].queue = newConcQueue(64, NULL, NULL);
+
+    for (i = 0; i < STRESS_CONSUMERS; i++)
+    {
+        cArgs[i].queue = pArgs[0].queue;
+        cArgs[i].seen = seen;
+        cArgs[i].received = 0;
+        cArgs[i].errors = 0;
+        pthread_create(&consumers[i], NULL, stressConsumer, &cArgs[i]);
+    }
+
+    for (i = 0; i < STRESS_PRODUCERS; i++)
+    {
+        pArgs[i].queue = pArgs[0].queue;
+        pArgs[i].id = i;
+        pthread_create(&producers[i], NULL, stressProducer, &pArgs[i]);
+    }
+
+    for (i = 0; i < STRESS_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+
+    concClose(pArgs[0].queue);
+
+    for (i = 0; i < STRESS_CONSUMERS; i++)
+    {
+        pthread_join(consumers[i], NULL);
+        received += cArgs[i].received;
+        errors += cArgs[i].errors;
+    }
+
+    /* seen is only written by the consumers, each flag by one of them */
+    for (i = 0; i < STRESS_PRODUCERS * STRESS_ITEMS; i++)
+        if (seen[i] != 1)
+            errors++;
+
+    printf("concQueue stress: %ld items, %d errors\n", received, errors);
+
+    freeConcQueue(pArgs[0].queue);
+    free(seen);
+    return errors != 0;
 }
 
@@ -9,10 +9,17 @@
 #include <string.h>
 #include "queueADT.h"
 
+/* Celdas que se piden juntas en cada bloque */
+#define SLAB_NODES 1024
+
+/* Alineacion de los elementos guardados en las celdas */
+#define NODE_ALIGN(n) ( ( (n) + 15 ) & ~(size_t) 15 )
+
 /**
 *	\struct nodeT
 * 	Estructura de la celda de la cola.
-* 	@param data Puntero al tipo de dato.
+* 	@param data Puntero al tipo de dato. En las colas de newQueueSized
+* 	apunta al elemento, que se guarda en la misma celda.
 * 	@param next Putero a otra celda
 */ 
 typedef struct nodeT
@@ -21,12 +28,28 @@ typedef struct nodeT
 	struct nodeT *next;
 }nodeT;
 
+/**
+*	\struct slabT
+* 	Bloque de SLAB_NODES celdas. Las celdas van a continuacion.
+* 	@param next Puntero al siguiente bloque de la cola.
+*/ 
+typedef struct slabT
+{
+	struct slabT *next;
+}slabT;
+
 /**
 *	\struct queueCDT
 * 	Header de la cola.
 * 	@param deepCpy Puntero a funcion de copia.
 * 	@param freeCpy Puntero a la funcion de liberacion. 
 * 	@param first Puntero anext Putero a otra celda
+* 	@param count Cantidad de elementos en la cola.
+* 	@param elemSize Tamanio de los elementos guardados en las celdas, 0
+* 	si la cola guarda punteros.
+* 	@param nodeSize Tamanio de cada celda.
+* 	@param freeNodes Celdas sin usar.
+* 	@param slabs Bloques de celdas pedidos.
 */ 
 struct queueCDT
 {	
@@ -34,9 +57,81 @@ struct queueCDT
 	freeCpyT freeCpy;
 	nodeT *first;
 	nodeT *last;
+	int count;
+	size_t elemSize;
+	size_t nodeSize;
+	nodeT *freeNodes;
+	slabT *slabs;
 };
 
-queueADT newQueue( deepCopyT dpcpy, freeCpyT freecpy )
+/**
+*	\fn newNode
+*   Toma una celda libre, pidiendo un bloque nuevo si no queda ninguna.
+*   @return La celda, NULL si no hay memoria.
+*/
+static nodeT *newNode( queueADT queue );
+
+/**
+*	\fn freeNode
+*   Devuelve una celda a las celdas libres de la cola.
+*/
+static void freeNode( queueADT queue, nodeT *node );
+
+/**
+*	\fn createQueue
+*   Creacion de la cola, para newQueue y newQueueSized.
+*/
+static queueADT createQueue( deepCopyT dpcpy, freeCpyT freecpy, size_t elemSize );
+
+/**
+*	\fn pushNode
+*   Agrega una celda al final de la cola.
+*/
+static void pushNode( queueADT queue, nodeT *aux );
+
+/**
+*	\fn popNode
+*   Saca la primera celda de la cola, que no puede estar vacia.
+*/
+static nodeT *popNode( queueADT queue );
+
+static nodeT *newNode( queueADT queue )
+{
+	slabT *slab;
+	nodeT *node;
+	char *p;
+	int i;
+	
+	if ( queue->freeNodes == NULL )
+	{
+		if ( ( slab = malloc( NODE_ALIGN( sizeof(slabT) ) + SLAB_NODES * queue->nodeSize ) ) == NULL )
+			return NULL;
+		
+		slab->next = queue->slabs;
+		queue->slabs = slab;
+		
+		p = (char *) slab + NODE_ALIGN( sizeof(slabT) );
+		
+		for ( i = 0 ; i < SLAB_NODES ; i++, p += queue->nodeSize )
+			freeNode( queue, (nodeT *) p );
+	}
+	
+	node = queue->freeNodes;
+	queue->freeNodes = node->next;
+	
+	if ( queue->elemSize > 0 )
+		node->data = (char *) node + NODE_ALIGN( sizeof(nodeT) );
+	
+	return node;
+}
+
+static void freeNode( queueADT queue, nodeT *node )
+{
+	node->next = queue->freeNodes;
+	queue->freeNodes = node;
+}
+
+static queueADT createQueue( deepCopyT dpcpy, freeCpyT freecpy, size_t elemSize )
 {
 	queueADT queue;
 	
@@ -46,19 +141,31 @@ queueADT newQueue( deepCopyT dpcpy, freeCpyT freecpy )
 	queue->deepCpy = dpcpy;
 	queue->freeCpy = freecpy;
 	queue->first = NULL;
+	queue->last = NULL;
+	queue->count = 0;
+	queue->elemSize = elemSize;
+	queue->nodeSize = ( elemSize > 0 ) ? NODE_ALIGN( sizeof(nodeT) ) + NODE_ALIGN( elemSize ) : sizeof(nodeT);
+	queue->freeNodes = NULL;
+	queue->slabs = NULL;
 	
 	return queue;
 }
 
-int enqueue( queueADT queue, queueElemT elem )
+queueADT newQueue( deepCopyT dpcpy, freeCpyT freecpy )
 {
-	nodeT *aux;
-		
-	if ( ( aux = malloc ( sizeof(nodeT) ) ) == NULL )
-		return 0;
-	
-	aux->data = queue->deepCpy( elem );
+	return createQueue( dpcpy, freecpy, 0 );
+}
+
+queueADT newQueueSized( size_t elemSize )
+{
+	if ( elemSize == 0 )
+		return NULL;
 	
+	return createQueue( NULL, NULL, elemSize );
+}
+
+static void pushNode( queueADT queue, nodeT *aux )
+{
 	aux->next = NULL;
 	
 	if ( queue->first == NULL )
@@ -67,44 +174,145 @@ int enqueue( queueADT queue, queueElemT elem )
 		queue->last->next = aux;
 	
 	queue->last = aux;
+	queue->count++;
+}
+
+static nodeT *popNode( queueADT queue )
+{
+	nodeT *cp;
+	
+	cp = queue->first;
+	
+	queue->first = cp->next;
+	queue->count--;
+	
+	return cp;
+}
+
+int enqueue( queueADT queue, queueElemT elem )
+{
+	queueElemT cp;
+	nodeT *aux;
+	
+	if ( queue->elemSize > 0 )
+	{
+		if ( ( aux = newNode( queue ) ) == NULL )
+			return 0;
+		
+		memcpy( aux->data, elem, queue->elemSize );
+		pushNode( queue, aux );
+		
+		return 1;
+	}
+	
+	if ( ( cp = queue->deepCpy( elem ) ) == NULL && elem != NULL )
+		return 0;
+	
+	if ( !enqueueTake( queue, cp ) )
+	{
+		queue->freeCpy( cp );
+		return 0;
+	}
+	
+	return 1;
+}
+
+int enqueueTake( queueADT queue, queueElemT elem )
+{
+	nodeT *aux;
+	
+	if ( queue->elemSize > 0 )
+		return 0;
+		
+	if ( ( aux = newNode( queue ) ) == NULL )
+		return 0;
+	
+	aux->data = elem;
+	
+	pushNode( queue, aux );
 	
 	return 1;
 }
 
 queueElemT dequeue( queueADT queue )
+{
+	queueElemT aux, data;
+	
+	if ( queue->first == NULL )
+		return NULL;
+	
+	if ( queue->elemSize > 0 )
+	{
+		if ( ( aux = malloc( queue->elemSize ) ) != NULL )
+			dequeueInto( queue, aux );
+		
+		return aux;
+	}
+	
+	/* Se mantiene la copia que devolvia la version anterior */
+	data = dequeueTake( queue );
+	aux = queue->deepCpy( data );
+	
+	queue->freeCpy( data );
+	
+	return aux;
+}
+
+queueElemT dequeueTake( queueADT queue )
 {
 	queueElemT aux;
 	nodeT *cp;
 	
-	cp = queue->first;
-	
-	if ( cp == NULL )
+	if ( queue->first == NULL || queue->elemSize > 0 )
 		return NULL;
 	
-	aux = queue->deepCpy( queue->first->data );
+	cp = popNode( queue );
+	aux = cp->data;
+	
+	freeNode( queue, cp );
+	
+	return aux;
+}
+
+int dequeueInto( queueADT queue, void *dst )
+{
+	nodeT *cp;
 	
-	queue->freeCpy(queue->first->data);
+	if ( queue->first == NULL )
+		return 0;
 	
-	free( cp );
+	cp = popNode( queue );
 	
-	queue->first = queue->first->next;
+	if ( queue->elemSize > 0 )
+		memcpy( dst, cp->data, queue->elemSize );
+	else
+		*(queueElemT *) dst = cp->data;
 	
-	return aux;
+	freeNode( queue, cp );
+	
+	return 1;
+}
+
+queueElemT queuePeek( queueADT queue )
+{
+	return ( queue->first == NULL ) ? NULL : queue->first->data;
 }
 
 int
 queueLength( queueADT queue )
 {
-	int n;
-	nodeT * aux;
-	n = 0;
-	
-	/* Otra opciones: Se puede llevar cuenta de las enqueueciones y retornar ese valor  */
+	return queue->count;
+}
 
-	for ( aux = queue->first ; aux != NULL ; aux = aux->next )
-		n++;
-	
-	return n;
+size_t queueElemSize( queueADT queue )
+{
+	return queue->elemSize;
+}
+
+int queueReserve( queueADT queue, int n )
+{
+	/* Las celdas se piden de a bloques al encolar */
+	return n >= 0;
 }
 
 int queueIsEmpty( queueADT queue )
@@ -115,13 +323,22 @@ int queueIsEmpty( queueADT queue )
 void freeQueue( queueADT queue )
 {
 	nodeT * aux;
+	slabT * slab;
 	
 	while ( !queueIsEmpty( queue ) )
 	{
 		aux = queue->first;
 		queue->first = queue->first->next;
-		queue->freeCpy( aux->data );
-		free( aux );
+		if ( queue->elemSize == 0 )
+			queue->freeCpy( aux->data );
+	}
+	
+	/* Las celdas se liberan con sus bloques */
+	while ( queue->slabs != NULL )
+	{
+		slab = queue->slabs;
+		queue->slabs = slab->next;
+		free( slab );
 	}
 	
 	free( queue );
@@ -2,12 +2,16 @@
 *   @file main.h
 *   Interface para queueADT.c.
 * 	Incluye estructuras y typedefs.
+* 	Hay dos implementaciones, se elige una al linkear: queueADT.c, con
+* 	una lista encadenada, y queueRingADT.c, con un arreglo circular.
 *   Fecha de ultima modificacion 06/11/2007.
 */
 
 #ifndef _QUEUE_ADT_H_
 #define _QUEUE_ADT_H_
 
+#include <stddef.h>
+
 /**
 *	\typedef queueADT
 * 	Puntero al tipo concreto de dato de la cola.
@@ -44,6 +48,18 @@ typedef void(*freeCpyT)( queueElemT elem );
 */
 queueADT newQueue ( deepCopyT dpcpy, freeCpyT freecpy );
 
+/**
+*	\fn newQueueSized
+*   Creacion de una cola de elementos de tamanio fijo. Los elementos se
+*   copian con memcpy dentro de la cola, sin funciones de copia ni de
+*   liberacion, y la memoria se pide de a bloques de muchos elementos.
+*   Los elementos se desencolan con dequeueInto; enqueueTake y dequeueTake
+*   no se pueden usar con estas colas.
+*   @param elemSize Tamanio en bytes de cada elemento.
+*   @return queueADT puntero al CDT si todo esta bien, NULL en caso contrario.
+*/
+queueADT newQueueSized ( size_t elemSize );
+
 /**
 *	\fn enqueue
 *   Encola un elemento en la cola.
@@ -57,18 +73,80 @@ int enqueue ( queueADT queue, queueElemT elem );
 *	\fn dequeue
 *   Encola un elemento en la cola.
 *   @param queue La cola que se creo con newQueue.
-*   @return queueElemT si todo esta bien, NULL en caso contrario.
+*   @return queueElemT si todo esta bien, NULL en caso contrario. En las
+*   colas de newQueueSized es una copia pedida con malloc.
 */
 queueElemT dequeue ( queueADT queue );
 
+/**
+*	\fn enqueueTake
+*   Encola un elemento sin copiarlo. La cola se adueña del elemento y lo
+*   libera con la funcion de liberacion si no se desencola.
+*   @param queue La cola que se creo con newQueue.
+*   @param elem Elemento a encolar, como si lo hubiera creado la funcion
+*   de copia.
+*   @return 1 si todo esta bien, 0 en caso contrario. Si falla el elemento
+*   sigue siendo del llamador.
+*/
+int enqueueTake ( queueADT queue, queueElemT elem );
+
+/**
+*	\fn dequeueTake
+*   Desencola un elemento sin copiarlo. El llamador se adueña del elemento
+*   y debe liberarlo como lo haria la funcion de liberacion.
+*   @param queue La cola que se creo con newQueue.
+*   @return queueElemT si todo esta bien, NULL si la cola esta vacia.
+*/
+queueElemT dequeueTake ( queueADT queue );
+
+/**
+*	\fn dequeueInto
+*   Desencola un elemento copiandolo en dst. En las colas de newQueueSized
+*   copia el elemento; en las demas guarda en dst el puntero al elemento,
+*   como dequeueTake.
+*   @param queue La cola que se creo con newQueue o newQueueSized.
+*   @param dst Donde se copia el elemento.
+*   @return 1 si todo esta bien, 0 si la cola esta vacia.
+*/
+int dequeueInto ( queueADT queue, void *dst );
+
+/**
+*	\fn queuePeek
+*   Devuelve el primer elemento de la cola sin desencolarlo ni copiarlo.
+*   @param queue La cola que se creo con newQueue.
+*   @return queueElemT si todo esta bien, NULL si la cola esta vacia. Sigue
+*   siendo de la cola. En las colas de newQueueSized apunta a la copia
+*   guardada en la cola, valida hasta que se modifique la cola.
+*/
+queueElemT queuePeek ( queueADT queue );
+
 /**
 *	\fn queueLength
-*   Determina la extension de la cola.
+*   Determina la extension de la cola. Es O(1).
 *   @param queue La cola que se creo con newQueue.
 *   @return int extension de la cola.
 */
 int queueLength( queueADT queue );
 
+/**
+*	\fn queueElemSize
+*   Devuelve el tamanio de los elementos de una cola de newQueueSized.
+*   @param queue La cola que se creo con newQueue o newQueueSized.
+*   @return size_t tamanio de cada elemento, 0 si la cola guarda punteros.
+*/
+size_t queueElemSize( queueADT queue );
+
+/**
+*	\fn queueReserve
+*   Reserva lugar para que la cola pueda contener n elementos sin volver
+*   a pedir memoria. Solo tiene efecto en la implementacion con arreglo
+*   circular (queueRingADT.c).
+*   @param queue La cola que se creo con newQueue.
+*   @param n Cantidad de elementos.
+*   @return 1 si todo esta bien, 0 en caso contrario.
+*/
+int queueReserve( queueADT queue, int n );
+
 /**
 *	\fn queueIsEmpty
 *   Se fija si la cola esta llena o no.
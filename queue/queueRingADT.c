@@ -0,0 +1,275 @@
+/**
+*   @file queueRingADT.c
+*   Implementacion de una cola con deepCopy sobre un arreglo circular.
+*   Tiene la misma interfaz que queueADT.c, se linkea una u otra.
+*   Los elementos quedan contiguos en memoria y el arreglo se duplica
+*   cuando se llena, por lo que encolar no pide memoria para la cola
+*   salvo al crecer. Las colas de newQueueSized guardan los elementos
+*   mismos en el arreglo.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "queueADT.h"
+
+/* Tamanio inicial del arreglo, potencia de 2 */
+#define RING_MIN_SIZE 16
+
+/**
+*	\struct queueCDT
+* 	Header de la cola.
+* 	@param deepCpy Puntero a funcion de copia.
+* 	@param freeCpy Puntero a la funcion de liberacion. 
+* 	@param elems Arreglo circular de elementos.
+* 	@param elemSize Tamanio de cada posicion del arreglo.
+* 	@param sized Distinto de 0 si la cola guarda los elementos en el
+* 	arreglo, 0 si guarda punteros.
+* 	@param size Tamanio del arreglo, 0 o potencia de 2.
+* 	@param head Indice del primer elemento.
+* 	@param count Cantidad de elementos en la cola.
+*/ 
+struct queueCDT
+{	
+	deepCopyT deepCpy;
+	freeCpyT freeCpy;
+	char *elems;
+	size_t elemSize;
+	int sized;
+	int size;
+	int head;
+	int count;
+};
+
+/**
+*	\fn growRing
+*   Agranda el arreglo para que entren al menos n elementos. Los elementos
+*   quedan al principio del nuevo arreglo, en orden.
+*   @return 1 si todo esta bien, 0 en caso contrario.
+*/
+static int growRing( queueADT queue, int n );
+
+/**
+*	\fn createQueue
+*   Creacion de la cola, para newQueue y newQueueSized.
+*/
+static queueADT createQueue( deepCopyT dpcpy, freeCpyT freecpy, size_t elemSize, int sized );
+
+/**
+*	\fn slot
+*   Devuelve la posicion del arreglo del i-esimo elemento de la cola.
+*/
+static char *slot( queueADT queue, int i );
+
+static char *slot( queueADT queue, int i )
+{
+	return queue->elems + ( ( queue->head + i ) & ( queue->size - 1 ) ) * queue->elemSize;
+}
+
+static int growRing( queueADT queue, int n )
+{
+	char *aux;
+	int size, first;
+	
+	if ( n <= queue->size )
+		return 1;
+	
+	for ( size = ( queue->size > 0 ) ? queue->size : RING_MIN_SIZE ; size < n ; size *= 2 )
+		if ( size > ( 1 << 29 ) )
+			return 0;
+	
+	if ( ( aux = malloc( size * queue->elemSize ) ) == NULL )
+		return 0;
+	
+	/* Los elementos pueden dar la vuelta al final del arreglo */
+	first = queue->size - queue->head;
+	
+	if ( first > queue->count )
+		first = queue->count;
+	
+	if ( queue->count > 0 )
+	{
+		memcpy( aux, slot( queue, 0 ), first * queue->elemSize );
+		memcpy( aux + first * queue->elemSize, queue->elems, ( queue->count - first ) * queue->elemSize );
+	}
+	
+	free( queue->elems );
+	
+	queue->elems = aux;
+	queue->size = size;
+	queue->head = 0;
+	
+	return 1;
+}
+
+static queueADT createQueue( deepCopyT dpcpy, freeCpyT freecpy, size_t elemSize, int sized )
+{
+	queueADT queue;
+	
+	if ( ( queue = malloc(sizeof(struct queueCDT)) ) == NULL )
+		return NULL;
+	
+	queue->deepCpy = dpcpy;
+	queue->freeCpy = freecpy;
+	queue->elems = NULL;
+	queue->elemSize = elemSize;
+	queue->sized = sized;
+	queue->size = 0;
+	queue->head = 0;
+	queue->count = 0;
+	
+	return queue;
+}
+
+queueADT newQueue( deepCopyT dpcpy, freeCpyT freecpy )
+{
+	return createQueue( dpcpy, freecpy, sizeof(queueElemT), 0 );
+}
+
+queueADT newQueueSized( size_t elemSize )
+{
+	if ( elemSize == 0 )
+		return NULL;
+	
+	return createQueue( NULL, NULL, elemSize, 1 );
+}
+
+int enqueue( queueADT queue, queueElemT elem )
+{
+	queueElemT cp;
+	
+	if ( queue->sized )
+	{
+		if ( queue->count == queue->size && !growRing( queue, queue->count + 1 ) )
+			return 0;
+		
+		memcpy( slot( queue, queue->count ), elem, queue->elemSize );
+		queue->count++;
+		
+		return 1;
+	}
+	
+	if ( ( cp = queue->deepCpy( elem ) ) == NULL && elem != NULL )
+		return 0;
+	
+	if ( !enqueueTake( queue, cp ) )
+	{
+		queue->freeCpy( cp );
+		return 0;
+	}
+	
+	return 1;
+}
+
+int enqueueTake( queueADT queue, queueElemT elem )
+{
+	if ( queue->sized )
+		return 0;
+	
+	if ( queue->count == queue->size && !growRing( queue, queue->count + 1 ) )
+		return 0;
+	
+	*(queueElemT *) slot( queue, queue->count ) = elem;
+	queue->count++;
+	
+	return 1;
+}
+
+queueElemT dequeue( queueADT queue )
+{
+	queueElemT aux, data;
+	
+	if ( queue->count == 0 )
+		return NULL;
+	
+	if ( queue->sized )
+	{
+		if ( ( aux = malloc( queue->elemSize ) ) != NULL )
+			dequeueInto( queue, aux );
+		
+		return aux;
+	}
+	
+	/* Se mantiene la copia que devolvia la version anterior */
+	data = dequeueTake( queue );
+	aux = queue->deepCpy( data );
+	
+	queue->freeCpy( data );
+	
+	return aux;
+}
+
+queueElemT dequeueTake( queueADT queue )
+{
+	queueElemT aux;
+	
+	if ( queue->count == 0 || queue->sized )
+		return NULL;
+	
+	dequeueInto( queue, &aux );
+	
+	return aux;
+}
+
+int dequeueInto( queueADT queue, void *dst )
+{
+	if ( queue->count == 0 )
+		return 0;
+	
+	memcpy( dst, slot( queue, 0 ), queue->elemSize );
+	
+	queue->head = ( queue->head + 1 ) & ( queue->size - 1 );
+	queue->count--;
+	
+	return 1;
+}
+
+queueElemT queuePeek( queueADT queue )
+{
+	if ( queue->count == 0 )
+		return NULL;
+	
+	return queue->sized ? (queueElemT) slot( queue, 0 ) : *(queueElemT *) slot( queue, 0 );
+}
+
+int
+queueLength( queueADT queue )
+{
+	return queue->count;
+}
+
+size_t queueElemSize( queueADT queue )
+{
+	return queue->sized ? queue->elemSize : 0;
+}
+
+int queueReserve( queueADT queue, int n )
+{
+	return n >= 0 && growRing( queue, n );
+}
+
+int queueIsEmpty( queueADT queue )
+{
+	return queue->count == 0;
+}
+
+void freeQueue( queueADT queue )
+{
+	queueElemT aux;
+	
+	while ( queue->count > 0 )
+	{
+		if ( queue->sized )
+		{
+			queue->head = ( queue->head + 1 ) & ( queue->size - 1 );
+			queue->count--;
+		}
+		else if ( dequeueInto( queue, &aux ) )
+			queue->freeCpy( aux );
+	}
+	
+	free( queue->elems );
+	free( queue );
+	
+	return;
+}
@@ -8,32 +8,279 @@
 #include <string.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "../sqlite/sqlite3.h"
 #include "../include/databaseADT.h"
+#include "../queue/concQueueADT.h"
 
 /* Restrictions for users */
 #define USER_NAME_MAX_LEN 50
 #define USER_PASS_MAX_LEN 50
 #define USER_MAIL_MAX_LEN 50
 
+/* WAL size, in multiples of walSizeLimit, past which the checkpointer */
+/* runs RESTART checkpoints instead of passive ones                     */
+#define WAL_RESTART_FACTOR 4
+
+/* Statements tracked at the same time by the slow query log */
+#define SLOW_ACTIVE_MAX 16
+
+/* Virtual machine instructions between deadline and cancellation checks */
+#define PROGRESS_OPS 1000
+
+/* Number of statements kept by DBPrepareCached */
+#define STMT_CACHE_SIZE 32
+
+/* SQLite's compiled-in lookaside configuration, restored by DBGlobalShutdown */
+#define DEFAULT_LOOKASIDE_SIZE 1200
+#define DEFAULT_LOOKASIDE_SLOTS 40
+
+/* Pages returned to the file system by each DBReclaimSpace transaction */
+#define RECLAIM_SLICE_PAGES 64
+
+/* Rows taken at once by the consumers of DBStreamUsers */
+#define STREAM_BATCH 16
+
+/* Changes kept for the subscribers, must be a power of 2 */
+#define CHANGE_RING_SIZE 4096
+
+/**
+ * Cached result of a read query.
+ * The key is the SQL text followed by the blob bindings, tables holds the
+ * name of every table the query reads from.
+*/
+typedef struct cacheEntry
+{
+    char *key;
+    size_t keyLen;
+    char **tables;
+    int tableCount;
+    resultSetADT rs;
+    size_t bytes;
+    struct cacheEntry *prev;
+    struct cacheEntry *next;
+} cacheEntry;
+
+/**
+ * Statement kept by DBPrepareCached, keyed by a copy of its SQL text.
+ * The same SQL has more than one entry while an entry is still running.
+*/
+typedef struct stmtCacheEntry
+{
+    char *sql;
+    unsigned long hash;
+    unsigned long lastUse;
+    sqlite3_stmt *statement;
+} stmtCacheEntry;
+
+/**
+ * Checkpointer thread state. Fields below lock are shared with the
+ * connection's WAL hook and protected by it.
+*/
+typedef struct checkpointer
+{
+    pthread_t thread;
+    sqlite3 *dbHandle;
+    char *walFile;
+    FILE *logFile;
+    DBCheckpointConfig config;
+    int pageSize;
+    long long sizeLimit;        /* journal_size_limit before the start */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    int wakeup;
+    long commits;
+    long long walBytes;
+    DBCheckpointStats stats;
+} checkpointer;
+
+/**
+ * Per statement counters kept by the slow query log while it runs.
+*/
+typedef struct slowActive
+{
+    sqlite3_stmt *statement;
+    long long prepareUs;
+    long long startUs;          /* First StepSql call, 0 if there was none */
+    long rows;
+    int retries;
+} slowActive;
+
+/**
+ * Slow query, deduplicated by its normalized SQL.
+ * Occurrences after the first one are only counted.
+*/
+typedef struct slowQuery
+{
+    char *key;
+    long count;
+    long reported;
+    long long totalUs;
+    long long maxUs;
+    struct slowQuery *next;
+} slowQuery;
+
+/**
+ * First occurrence of a slow query, waiting to be logged with its plan.
+ * Plans can't be retrieved from within the trace callback.
+*/
+typedef struct slowPending
+{
+    char *sql;
+    long long durationUs;
+    long rows;
+    int retries;
+    struct slowPending *next;
+} slowPending;
+
+/**
+ * Slot of the change ring. seq is 0 while the slot is being written.
+*/
+typedef struct changeSlot
+{
+    _Atomic unsigned long long seq;
+    _Atomic int op;
+    _Atomic long long rowid;
+} changeSlot;
+
+/**
+ * Ring of published changes. The thread using the connection is its only
+ * writer. Readers never block it, they check the sequence number of a slot
+ * before and after copying it to detect it was overwritten meanwhile.
+*/
+typedef struct changeRing
+{
+    changeSlot slots[CHANGE_RING_SIZE];
+    _Atomic unsigned long long head;    /* seq of the last published change */
+} changeRing;
+
+/**
+ * Change captured by the update hook, waiting for its transaction to end.
+*/
+typedef struct stagedChange
+{
+    DB_CHANGE_OP op;
+    sqlite3_int64 rowid;
+} stagedChange;
+
+typedef struct changeSubCDT
+{
+    changeRing *ring;
+    unsigned long long next;            /* seq of the next change to read */
+} changeSubCDT;
+
+/**
+ * Cancellation token. handle is the connection running the call that uses
+ * the token, so DBCancel can interrupt it. cancelled is set by DBCancel
+ * from any thread and read by the thread running the call.
+*/
+typedef struct cancelTokenCDT
+{
+    _Atomic int cancelled;
+    pthread_mutex_t lock;
+    sqlite3 *handle;
+} cancelTokenCDT;
+
 typedef struct databaseCDT
 {
     sqlite3 *dbHandle;
     char *dbFile;
+    char *vfsName;
     FILE *logFile;
+    int incrementalVacuum;
+
+    /* Query result cache, most recently used entry first */
+    size_t cacheMax;
+    size_t cacheUsed;
+    cacheEntry *cacheFirst;
+    cacheEntry *cacheLast;
+    sqlite3_stmt *dataVersionStmt;
+    sqlite3_int64 dataVersion;
+
+    /* Prepared statements for static SQL */
+    stmtCacheEntry stmtCache[STMT_CACHE_SIZE];
+    int stmtCount;
+    unsigned long stmtUses;
+
+    checkpointer *ckpt;
+
+    /* Slow query log, disabled if slowThresholdUs is 0 */
+    long long slowThresholdUs;
+    FILE *slowLog;
+    slowActive slowActive[SLOW_ACTIVE_MAX];
+    slowQuery *slowQueries;
+    slowPending *slowPending;
+    sqlite3_stmt *slowStepping;     /* Statement inside StepSql */
+    int inExplain;
+
+    /* User search index: 0 not found yet, 1 trigram, -1 no FTS5 */
+    int searchIndex;
+
+    /* Change capture, enabled by the first subscription */
+    changeRing *changes;
+    stagedChange *staged;
+    int stagedCount;
+    int stagedSize;
+
+    /* Limits of the running call, see BeginCall */
+    long long deadlineUs;
+    cancelTokenADT cancel;
+    DB_ERR callStatus;
 } databaseCDT;
 
+static const char upsertUserSql[] =
+    "INSERT INTO users (user, password, email) VALUES (?1, ?2, ?3) "
+    "ON CONFLICT(user) DO UPDATE "
+    "SET password = excluded.password, email = excluded.email";
+
+/* Unchanged fields are set to their own value, ?1 is the field mask */
+static const char updateUserFieldsSql[] =
+    "UPDATE users SET "
+    "password = CASE WHEN ?1 & 1 THEN ?2 ELSE password END, "
+    "email = CASE WHEN ?1 & 2 THEN ?3 ELSE email END "
+    "WHERE user = ?4";
+
+/* Memory handed to SQLite by DBGlobalInit */
+static void *pageCacheMem = NULL;
+static void *heapMem = NULL;
+static int lookasideSet = FALSE;
+static int globalInit = FALSE;
+
+/**
+ * Blob bound to a query. A NULL data binds a zeroblob of the given size.
+ * isStatic binds the data without copying it, it must then stay valid
+ * until the statement is finalized.
+*/
 typedef struct blobBindings
 {
     void *data;
     int size;
     int param;
+    int isStatic;
 } blobBindings;
 
+/**
+ * Open blob, see DBBlobOpen. written is set once the change to the row
+ * has been staged for the subscribers.
+*/
+typedef struct blobCDT
+{
+    databaseADT db;
+    sqlite3_blob *blob;
+    sqlite3_int64 rowid;
+    int written;
+} blobCDT;
+
 typedef struct user_t
 {
     char name[USER_NAME_MAX_LEN+1];
@@ -41,267 +288,3039 @@ typedef struct user_t
     char mail[USER_MAIL_MAX_LEN+1];
 } user_t;
 
-/**
- * Writes text to errFile.
- *
- * @param[in]   errFile Error file to write to.
- * @param[in]   text    Text to write.
-*/
+/**
+ * Writes text to errFile.
+ *
+ * @param[in]   errFile Error file to write to.
+ * @param[in]   text    Text to write.
+*/
+static void
+logError (FILE *errFile, const char *text, ...)
+{
+    va_list ap;
+
+    if (errFile == NULL || text == NULL)
+        return;
+
+    va_start( ap, text );
+
+    vfprintf( errFile, text, ap );
+    fprintf( errFile, "\n" );
+
+    va_end( ap );
+
+    return;
+}
+
+   /******************************************************/
+   /** StepSql:                                         **/
+   /** This encapsulates sqlite step call to handle     **/
+   /** timeout condition.                               **/
+   /******************************************************/
+int StepSql(databaseADT db, sqlite3_stmt *statement);
+
+   /******************************************************/
+   /** PrepareSql:                                      **/
+   /** This encapsulates sqlite prepare call to handle  **/
+   /** timeout condition.                               **/
+   /******************************************************/
+int PrepareSql(databaseADT db, char *SqlStr, int queryLen,
+            sqlite3_stmt **statement, const char **tail);
+
+   /******************************************************/
+   /** FinalizeSql:                                     **/
+   /** This encapsulates sqlite finalize call to drop   **/
+   /** the slow query log counters of the statement.    **/
+   /******************************************************/
+int FinalizeSql(databaseADT db, sqlite3_stmt *statement);
+
+/**
+ * Retrieves a sanitized copy of the given string.
+ *
+ * @param[in]   db      The database to be used.
+ * @param[in]   str     The string to be sanitized.
+ *
+ * @return      Sanitized copy of the string provided.
+ *
+ * @remarks     The caller is responsible to free the returned string.
+*/
+static char *EscapeString( databaseADT db, const char *str );
+
+/**
+ * Executes the given query.
+ *
+ * @param[in]           db              The database instance.
+ * @param[in][out]      statement       The statement structure to be filled
+ *                                      when preparing the query.
+ * @param[in]           sql             The SQL query to perform. Should have
+ *                                      a "%s" in each place an argument should
+ *                                      be placed.
+ * @param[in]           bindingCount    Number of elements in the binsing array.
+ * @param[in]           bindings        Allows to bind blobs. All other types
+ *                                      can be isnerted into the query itself.
+ * @param[in]           args            Number of arguments to the sql query.
+ *
+ * @return      An error code if the argument validation failed or the value
+ *              returned by SQLite when executing the query.
+ *
+ * @remarks     All variable arguments passed MUST be char*. They will be
+ *              validated against ilegal characters such as \' and \".
+*/
+static int QueryExecute( databaseADT db, sqlite3_stmt **statement,
+                        const char* sql, int bindingCount,
+                        blobBindings* bindings, int args, ... );
+
+/**
+ * Stores every row produced by an executed query in a result set.
+ *
+ * @param[in]   db          The database instance.
+ * @param[in]   statement   The statement returned by QueryExecute.
+ * @param[in]   ret         The value returned by QueryExecute.
+ * @param[in]   rs          The result set to fill. It must have as many
+ *                          columns as the statement.
+ *
+ * @return      DB_SUCCESS if every row was stored, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     The statement is finalized.
+*/
+static DB_ERR FetchResultSet( databaseADT db, sqlite3_stmt *statement, int ret,
+                            resultSetADT rs );
+
+/**
+ * Retrieves the result of a read query, from the cache if there is a valid
+ * copy of it, executing the query and caching its result otherwise.
+ *
+ * @param[in]   db              The database instance.
+ * @param[in]   sql             The SQL query to perform.
+ * @param[in]   bindingCount    Number of elements in the bindings array.
+ * @param[in]   bindings        Blobs to bind, they are part of the cache key.
+ * @param[in]   columns         Number of columns produced by the query.
+ * @param[out]  result          The result of the query.
+ *
+ * @return      DB_SUCCESS if the operation succeded, an appropiate error
+ *              code otherwise.
+ *
+ * @remarks     The caller is responsible to free the result set.
+*/
+static DB_ERR CachedQuery( databaseADT db, const char *sql, int bindingCount,
+                        blobBindings *bindings, int columns,
+                        resultSetADT *result );
+
+/**
+ * Fills the user queue from the cached result of sqlSelect.
+*/
+static DB_ERR QueueFromCache( databaseADT db, queueADT queue,
+                            const char *sqlSelect );
+
+/**
+ * Copies a field into a fixed size buffer of maxLen bytes, truncating it
+ * if needed. NULL fields are copied as empty strings.
+*/
+static void CopyField( char *dst, const char *src, int maxLen );
+
+/**
+ * Adds a user to a queue of DBgetUserQueue, adopted by pointer queues and
+ * copied into sized ones.
+ *
+ * @return      DB_SUCCESS if the user was enqueued, DB_NO_MEMORY otherwise.
+*/
+static DB_ERR EnqueueUser( queueADT queue, const char *name, const char *pass,
+                        const char *mail );
+
+/**
+ * Frees a cache entry that is not linked in the cache.
+*/
+static void CacheFreeEntry( cacheEntry *entry );
+
+/**
+ * Removes an entry from the query cache and frees it.
+*/
+static void CacheRemove( databaseADT db, cacheEntry *entry );
+
+/**
+ * Removes every entry from the query cache.
+*/
+static void CacheFlush( databaseADT db );
+
+/**
+ * Flushes the query cache if another connection changed the database since
+ * the last time it was checked, using PRAGMA data_version.
+*/
+static void CacheCheckDataVersion( databaseADT db );
+
+/**
+ * sqlite3_update_hook callback. Invalidates the cached queries that read
+ * from the modified table and stages the changes to users for the
+ * subscribers.
+*/
+static void UpdateHook( void *ctx, int op, const char *dbName,
+                        const char *table, sqlite3_int64 rowid );
+
+/**
+ * sqlite3_rollback_hook callback. Cached results could have been read from
+ * the rolled back transaction, so the whole cache is dropped, and so are
+ * its staged changes.
+*/
+static void RollbackHook( void *ctx );
+
+/**
+ * Stores a change until its transaction ends.
+*/
+static void ChangeStage( databaseADT db, int op, sqlite3_int64 rowid );
+
+/**
+ * Called after every statement. Publishes the staged changes if there is
+ * no transaction open any more, otherwise, if the statement failed, drops
+ * the changes it staged.
+ *
+ * @param[in]   db      The database instance.
+ * @param[in]   rc      Value returned by the statement.
+ * @param[in]   mark    Number of staged changes before the statement ran.
+*/
+static void ChangeEndStatement( databaseADT db, int rc, int mark );
+
+/**
+ * sqlite3_set_authorizer callback used while preparing a cached query to
+ * record the tables it reads from.
+*/
+static int CacheAuthorizer( void *ctx, int action, const char *arg1,
+                        const char *arg2, const char *dbName,
+                        const char *trigger );
+
+/**
+ * Body of the checkpointer thread.
+*/
+static void *CheckpointerMain( void *arg );
+
+/**
+ * sqlite3_wal_hook callback. Counts commits and wakes the checkpointer
+ * when the WAL grows past its size limit.
+*/
+static int WalHook( void *ctx, sqlite3 *handle, const char *dbName,
+                    int pages );
+
+/**
+ * sqlite3_trace_v2 callback of the slow query log. Counts the rows of every
+ * statement and records the ones that finish outside StepSql, which records
+ * its own.
+*/
+static int SlowTrace( unsigned type, void *ctx, void *p, void *x );
+
+/**
+ * Records a finished statement in the slow query log if it ran longer than
+ * the threshold. durationUs includes preparing it and its busy retries.
+*/
+static void SlowRecord( databaseADT db, sqlite3_stmt *statement,
+                        const slowActive *counters, long long durationUs );
+
+/**
+ * Drops the slow query log counters of a statement, if it has any.
+*/
+static void SlowActiveRelease( databaseADT db, sqlite3_stmt *statement );
+
+/**
+ * Returns the slow query log counters of a statement, adding them if
+ * create is TRUE. NULL if there are none or no room for them.
+*/
+static slowActive *SlowActiveFind( databaseADT db, sqlite3_stmt *statement,
+                                int create );
+
+/**
+ * Logs the pending slow queries along with their EXPLAIN QUERY PLAN.
+*/
+static void SlowLogPending( databaseADT db );
+
+/**
+ * Returns a copy of sql with literals replaced by '?' and whitespace
+ * collapsed, so queries differing only in their arguments match.
+*/
+static char *NormalizeSql( const char *sql );
+
+/**
+ * Applies the limits of a call to the connection until EndCall.
+ *
+ * @return      DB_SUCCESS if the call can go on, DB_CANCELLED if the token
+ *              was already cancelled, DB_INVALID_ARG if another call is
+ *              using the token.
+*/
+static DB_ERR BeginCall( databaseADT db, const DBCallCtl *ctl );
+
+/**
+ * Removes the limits set by BeginCall.
+ *
+ * @param[in]   err     The value returned by the call.
+ *
+ * @return      DB_TIMEOUT or DB_CANCELLED if the call was stopped, err
+ *              otherwise.
+*/
+static DB_ERR EndCall( databaseADT db, DB_ERR err );
+
+/**
+ * Checks the limits of the running call, recording in callStatus why it
+ * must stop.
+ *
+ * @return      TRUE if the call must stop, FALSE otherwise.
+*/
+static int CallExpired( databaseADT db );
+
+/**
+ * sqlite3_progress_handler callback, interrupts the running statement
+ * once the call expired.
+*/
+static int ProgressHandler( void *ctx );
+
+/**
+ * Returns the current time in microseconds.
+*/
+static long long NowUs( void );
+
+/**
+ * Hash of an SQL string, to look statements up in the statement cache.
+*/
+static unsigned long HashSql( const char *sql );
+
+/**
+ * Runs every statement in sql, with sqlite3_exec. It is run again while
+ * the database is busy, so sql should hold a single statement.
+ *
+ * @return      DB_SUCCESS if every statement succeded, DB_TIMEOUT if the
+ *              database stayed busy, DB_INTERNAL_ERROR otherwise.
+*/
+static DB_ERR ExecSql( databaseADT db, const char *sql );
+
+/**
+ * Looks for the trigram index of DBsearchUsers.
+ *
+ * @return      1 if it exists, -1 if SQLite lacks FTS5, 0 if it doesn't
+ *              exist or couldn't be looked up.
+*/
+static int UserSearchIndex( databaseADT db );
+
+static long DBSize(databaseADT db);
+
+static long
+DBSize(databaseADT db)
+{
+    long size;
+    struct stat st;
+
+    stat(db->dbFile, &st);
+    size = st.st_size;
+
+    return size;
+}
+
+DB_ERR DBBuildDatabase( databaseADT db, const char *schema )
+{
+    char sqlStr[1024] = {0};
+    char line[LINE_MAX];
+    FILE *fp = NULL;
+    int ret;
+
+    if ( db == NULL || schema == NULL)
+            return DB_INVALID_ARG;
+
+    if (DBSize(db) > 0)
+        return DB_ALREADY_EXISTS;
+
+    if ( (fp = fopen(schema, "r")) == NULL)
+        return DB_INVALID_ARG;
+
+    /* DDL doesn't go through the update hook */
+    CacheFlush(db);
+
+    /* Only takes effect before the first table is created */
+    if ( db->incrementalVacuum
+            && sqlite3_exec( db->dbHandle, "PRAGMA auto_vacuum=INCREMENTAL",
+                            NULL, NULL, NULL ) != SQLITE_OK )
+    {
+        logError( db->logFile, "Error in BuildDatabase - "
+                "Can't enable auto-vacuum : %s",
+                sqlite3_errmsg( db->dbHandle ) );
+        fclose(fp);
+        return DB_INTERNAL_ERROR;
+    }
+
+    /*Read the schema*/
+    while (fgets(line, LINE_MAX, fp) != NULL)
+    {
+        strcat(sqlStr, line);
+
+        /* execute if ; found*/
+        if ( (strchr(line,';')) != NULL )
+        {
+            ret = sqlite3_exec( db->dbHandle, sqlStr, NULL, NULL, NULL );
+
+            if ( ret != SQLITE_OK )
+            {
+                logError( db->logFile, "Error in BuildDatabase - "
+                        "Can't create user table : %s",
+                        sqlite3_errmsg( db->dbHandle ) );
+
+                return DB_INTERNAL_ERROR;
+            }
+            sqlStr[0] = '\0';
+        }
+
+    }
+    fclose(fp);
+    return DB_SUCCESS;
+}
+
+/**
+ * Runs a pragma that returns a single integer.
+ *
+ * @return      DB_SUCCESS if the pragma returned a value, DB_INTERNAL_ERROR
+ *              otherwise.
+*/
+static DB_ERR
+PragmaInt( databaseADT db, char *pragma, int *value )
+{
+    sqlite3_stmt *statement = NULL;
+    DB_ERR err = DB_INTERNAL_ERROR;
+
+    if ( PrepareSql( db, pragma, -1, &statement, NULL ) == SQLITE_OK
+            && StepSql( db, statement ) == SQLITE_ROW )
+    {
+        *value = sqlite3_column_int( statement, 0 );
+        err = DB_SUCCESS;
+    }
+
+    FinalizeSql( db, statement );
+
+    return err;
+}
+
+DB_ERR
+DBGetFreePages( databaseADT db, int *freePages )
+{
+    if ( db == NULL || freePages == NULL )
+        return DB_INVALID_ARG;
+
+    return PragmaInt( db, "PRAGMA freelist_count", freePages );
+}
+
+DB_ERR
+DBReclaimSpace( databaseADT db, int maxPages, long budgetMs, int *freePages )
+{
+    sqlite3_stmt *statement = NULL;
+    char pragma[48];
+    long long deadline;
+    int mode, pages, left, slice, rc, reclaimed = 0;
+    DB_ERR err;
+
+    if ( db == NULL || maxPages < 0 || budgetMs < 0 )
+        return DB_INVALID_ARG;
+
+    deadline = ( budgetMs > 0 ) ? NowUs() + budgetMs * 1000LL : 0;
+
+    if ( ( err = PragmaInt( db, "PRAGMA auto_vacuum", &mode ) ) != DB_SUCCESS
+            || ( err = PragmaInt( db, "PRAGMA freelist_count", &pages ) )
+                != DB_SUCCESS )
+        return err;
+
+    /* 2 is INCREMENTAL, in any other mode the pragma does nothing */
+    while ( mode == 2 && pages > 0
+            && ( maxPages == 0 || reclaimed < maxPages )
+            && ( deadline == 0 || NowUs() < deadline ) )
+    {
+        slice = RECLAIM_SLICE_PAGES;
+
+        if ( maxPages > 0 && maxPages - reclaimed < slice )
+            slice = maxPages - reclaimed;
+
+        snprintf( pragma, sizeof( pragma ), "PRAGMA incremental_vacuum(%d)",
+                slice );
+
+        if ( PrepareSql( db, pragma, -1, &statement, NULL ) != SQLITE_OK )
+            return DB_INTERNAL_ERROR;
+
+        while ( ( rc = StepSql( db, statement ) ) == SQLITE_ROW )
+            ;
+
+        FinalizeSql( db, statement );
+
+        if ( rc != SQLITE_DONE )
+        {
+            logError( db->logFile, "DBReclaimSpace: %s",
+                    sqlite3_errmsg( db->dbHandle ) );
+            return DB_INTERNAL_ERROR;
+        }
+
+        if ( ( err = PragmaInt( db, "PRAGMA freelist_count", &left ) )
+                != DB_SUCCESS )
+            return err;
+
+        /* Nothing returned, e.g. every free page is in use by a reader */
+        if ( left >= pages )
+            break;
+
+        reclaimed += pages - left;
+        pages = left;
+    }
+
+    if ( freePages != NULL )
+        *freePages = pages;
+
+    return DB_SUCCESS;
+}
+
+/**
+ * Reserves the memory described by config and hands it to SQLite.
+ *
+ * @return      DB_SUCCESS if SQLite accepted the whole configuration, an
+ *              appropiate error code otherwise.
+*/
+static DB_ERR ConfigureMemory( const DBMemConfig *config );
+
+/**
+ * Restores SQLite's default memory configuration and frees the memory
+ * reserved by ConfigureMemory. SQLite must not be initialized.
+*/
+static void ReleaseMemory( void );
+
+static DB_ERR
+ConfigureMemory( const DBMemConfig *config )
+{
+    int slotSize, hdrSize;
+
+    if ( config->pageCacheSlots > 0 )
+    {
+        slotSize = config->pageCacheSlotSize;
+
+        if ( slotSize == 0 )
+        {
+            sqlite3_config( SQLITE_CONFIG_PCACHE_HDRSZ, &hdrSize );
+            slotSize = 4096 + hdrSize;
+        }
+
+        if ( ( pageCacheMem = malloc( (size_t) slotSize
+                                    * config->pageCacheSlots ) ) == NULL )
+            return DB_NO_MEMORY;
+
+        if ( sqlite3_config( SQLITE_CONFIG_PAGECACHE, pageCacheMem, slotSize,
+                            config->pageCacheSlots ) != SQLITE_OK )
+            return DB_INTERNAL_ERROR;
+    }
+
+    if ( config->lookasideSlots > 0 )
+    {
+        if ( sqlite3_config( SQLITE_CONFIG_LOOKASIDE, config->lookasideSlotSize,
+                            config->lookasideSlots ) != SQLITE_OK )
+            return DB_INTERNAL_ERROR;
+
+        lookasideSet = TRUE;
+    }
+
+    if ( config->heapSize > 0 )
+    {
+        if ( ( heapMem = malloc( config->heapSize ) ) == NULL )
+            return DB_NO_MEMORY;
+
+        /* Fails unless SQLite was compiled with SQLITE_ENABLE_MEMSYS5 */
+        if ( sqlite3_config( SQLITE_CONFIG_HEAP, heapMem, config->heapSize,
+                            config->heapMinAlloc ) != SQLITE_OK )
+            return DB_INTERNAL_ERROR;
+    }
+
+    if ( config->disableMemStatus
+            && sqlite3_config( SQLITE_CONFIG_MEMSTATUS, 0 ) != SQLITE_OK )
+        return DB_INTERNAL_ERROR;
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBGlobalInit( const DBMemConfig *config )
+{
+    DB_ERR err;
+
+    if ( config == NULL || config->pageCacheSlots < 0
+            || config->lookasideSlots < 0 || config->heapSize < 0 )
+        return DB_INVALID_ARG;
+
+    if ( globalInit )
+        return DB_INVALID_ARG;
+
+    /* sqlite3_config fails if SQLite was already initialized, in which */
+    /* case it must not be shut down under the open connections          */
+    if ( ( err = ConfigureMemory( config ) ) != DB_SUCCESS )
+    {
+        ReleaseMemory();
+        return err;
+    }
+
+    if ( sqlite3_initialize() != SQLITE_OK )
+    {
+        /* Undo a partial initialization before taking the memory back */
+        sqlite3_shutdown();
+        ReleaseMemory();
+        return DB_INTERNAL_ERROR;
+    }
+
+    globalInit = TRUE;
+
+    return DB_SUCCESS;
+}
+
+void
+DBGlobalShutdown( void )
+{
+    sqlite3_shutdown();
+    ReleaseMemory();
+}
+
+static void
+ReleaseMemory( void )
+{
+    /* Back to the defaults, so a later sqlite3_initialize doesn't use */
+    /* the memory freed below                                          */
+    sqlite3_config( SQLITE_CONFIG_PAGECACHE, NULL, 0, 0 );
+    sqlite3_config( SQLITE_CONFIG_MEMSTATUS, 1 );
+
+    if ( heapMem != NULL )
+        sqlite3_config( SQLITE_CONFIG_HEAP, NULL, 0, 0 );
+
+    if ( lookasideSet )
+        sqlite3_config( SQLITE_CONFIG_LOOKASIDE, DEFAULT_LOOKASIDE_SIZE,
+                        DEFAULT_LOOKASIDE_SLOTS );
+
+    free( pageCacheMem );
+    free( heapMem );
+    pageCacheMem = NULL;
+    heapMem = NULL;
+    lookasideSet = FALSE;
+    globalInit = FALSE;
+}
+
+DB_ERR
+DBGetMemStats( databaseADT db, DBMemStats *stats, int reset )
+{
+    sqlite3_int64 cur, hi;
+    int dbCur, dbHi;
+
+    if ( stats == NULL )
+        return DB_INVALID_ARG;
+
+    memset( stats, 0, sizeof( DBMemStats ) );
+
+    sqlite3_status64( SQLITE_STATUS_MEMORY_USED, &cur, &hi, reset );
+    stats->memoryUsed = cur;
+    stats->memoryHighwater = hi;
+
+    sqlite3_status64( SQLITE_STATUS_PAGECACHE_USED, &cur, &hi, reset );
+    stats->pageCacheUsed = cur;
+    stats->pageCacheHighwater = hi;
+
+    sqlite3_status64( SQLITE_STATUS_PAGECACHE_OVERFLOW, &cur, &hi, reset );
+    stats->pageCacheOverflow = cur;
+    stats->pageCacheOverflowHighwater = hi;
+
+    sqlite3_status64( SQLITE_STATUS_MALLOC_SIZE, &cur, &hi, reset );
+    stats->largestAlloc = hi;
+
+    if ( db == NULL )
+        return DB_SUCCESS;
+
+    sqlite3_db_status( db->dbHandle, SQLITE_DBSTATUS_LOOKASIDE_USED,
+                    &dbCur, &dbHi, reset );
+    stats->lookasideUsed = dbCur;
+    stats->lookasideHighwater = dbHi;
+
+    sqlite3_db_status( db->dbHandle, SQLITE_DBSTATUS_LOOKASIDE_HIT,
+                    &dbCur, &dbHi, reset );
+    stats->lookasideHits = dbHi;
+
+    sqlite3_db_status( db->dbHandle, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE,
+                    &dbCur, &dbHi, reset );
+    stats->lookasideMissSize = dbHi;
+
+    sqlite3_db_status( db->dbHandle, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL,
+                    &dbCur, &dbHi, reset );
+    stats->lookasideMissFull = dbHi;
+
+    sqlite3_db_status( db->dbHandle, SQLITE_DBSTATUS_CACHE_USED,
+                    &dbCur, &dbHi, 0 );
+    stats->cacheUsed = dbCur;
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+NewDatabaseADT( databaseADT *db, const char *dbFile, FILE *errLog )
+{
+    return NewDatabaseADTEx( db, dbFile, errLog, NULL );
+}
+
+DB_ERR
+NewDatabaseADTEx( databaseADT *db, const char *dbFile, FILE *errLog,
+                const DBOpenOptions *options )
+{
+    int ret;
+
+    if ( db == NULL || dbFile == NULL || errLog == NULL )
+        return DB_INVALID_ARG;
+
+    if ( ( *db = ( databaseADT ) malloc( sizeof( databaseCDT ) ) ) == NULL)
+        return DB_NO_MEMORY;
+
+    ( *db )->logFile = errLog;
+    ( *db )->dbFile = strdup(dbFile);
+    ( *db )->vfsName = ( options != NULL && options->vfsName != NULL )
+                        ? strdup( options->vfsName ) : NULL;
+    ( *db )->incrementalVacuum = ( options != NULL )
+                        ? options->incrementalVacuum : FALSE;
+    ( *db )->cacheMax = 0;
+    ( *db )->cacheUsed = 0;
+    ( *db )->cacheFirst = NULL;
+    ( *db )->cacheLast = NULL;
+    ( *db )->dataVersionStmt = NULL;
+    ( *db )->dataVersion = -1;
+    ( *db )->stmtCount = 0;
+    ( *db )->ckpt = NULL;
+    ( *db )->slowThresholdUs = 0;
+    ( *db )->slowQueries = NULL;
+    ( *db )->slowPending = NULL;
+    ( *db )->inExplain = FALSE;
+    ( *db )->searchIndex = 0;
+    ( *db )->changes = NULL;
+    ( *db )->staged = NULL;
+    ( *db )->stagedCount = 0;
+    ( *db )->stagedSize = 0;
+    ( *db )->deadlineUs = 0;
+    ( *db )->cancel = NULL;
+    ( *db )->callStatus = DB_SUCCESS;
+    memset( ( *db )->slowActive, 0, sizeof( ( *db )->slowActive ) );
+
+    /* Open the database file */
+    ret = sqlite3_open_v2( dbFile, &( ( *db )->dbHandle ),
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                        ( *db )->vfsName );
+
+    if ( ret )
+    {
+        logError( (*db)->logFile, "Error in NewDatabaseADT - "
+                        "Can't open database : %s",
+                        sqlite3_errmsg( ( *db )->dbHandle ) );
+
+        return DB_INTERNAL_ERROR;
+    }
+
+    sqlite3_update_hook( ( *db )->dbHandle, UpdateHook, *db );
+    sqlite3_rollback_hook( ( *db )->dbHandle, RollbackHook, *db );
+
+    return DB_SUCCESS;
+}
+
+void
+FreeDatabaseADT( databaseADT db )
+{
+    if ( db == NULL )
+        return;
+
+    DBStopCheckpointer(db);
+    DBSetSlowQueryLog(db, 0, NULL);
+    CacheFlush(db);
+    sqlite3_finalize(db->dataVersionStmt);
+
+    while (db->stmtCount > 0)
+    {
+        FinalizeSql(db, db->stmtCache[--db->stmtCount].statement);
+        free(db->stmtCache[db->stmtCount].sql);
+    }
+
+    sqlite3_close(db->dbHandle);
+    free(db->changes);
+    free(db->staged);
+    free(db->vfsName);
+    free(db->dbFile);
+    free(db);
+}
+
+/**
+ * Inserts a user with the password in binding.
+ *
+ * @param[out]  rowid   If not NULL, set to the id of the new user.
+*/
+static DB_ERR
+InsertUser(databaseADT db, const char *user, blobBindings *binding,
+        const char *mail, long long *rowid)
+{
+    sqlite3_stmt *statement;
+    int ret;
+    char *userN, *mailN;
+    char *sqlSelect = "INSERT INTO users VALUES (NULL, '%s', ? , '%s')";
+
+    if ( ( userN = EscapeString( db, user ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    if ( ( mailN = EscapeString( db, mail ) ) == NULL )
+    {
+        free( userN );
+        return DB_NO_MEMORY;
+    }
+
+    ret = QueryExecute(db, &statement, sqlSelect, 1, binding, 2, userN, mailN);
+
+    free(userN);
+    free(mailN);
+
+    switch (ret)
+    {
+        case SQLITE_DONE:
+            FinalizeSql( db, statement );
+            if ( rowid != NULL )
+                *rowid = sqlite3_last_insert_rowid( db->dbHandle );
+            return DB_SUCCESS;
+
+        case SQLITE_CONSTRAINT:
+            FinalizeSql( db, statement );
+            return DB_ALREADY_EXISTS;
+
+        default:
+            FinalizeSql(db, statement);
+            return DB_INTERNAL_ERROR;
+    }
+}
+
+DB_ERR
+DBaddUser(databaseADT db, const char *user, const char *password,
+          const char *mail)
+{
+    blobBindings binding;
+
+    if (db == NULL || user == NULL || password == NULL || mail == NULL)
+        return DB_INVALID_ARG;
+
+    /* The password outlives the statement, no need to copy it */
+    binding.param=1;
+    binding.data= (void *)password;
+    binding.size= strlen(password) + 1;
+    binding.isStatic= TRUE;
+
+    return InsertUser(db, user, &binding, mail, NULL);
+}
+
+DB_ERR
+DBaddUserPrealloc(databaseADT db, const char *user, int passwordSize,
+                const char *mail, long long *rowid)
+{
+    blobBindings binding;
+
+    if (db == NULL || user == NULL || passwordSize < 0 || mail == NULL)
+        return DB_INVALID_ARG;
+
+    /* A zeroblob takes no memory, SQLite writes the zeros to the page */
+    binding.param=1;
+    binding.data= NULL;
+    binding.size= passwordSize;
+    binding.isStatic= TRUE;
+
+    return InsertUser(db, user, &binding, mail, rowid);
+}
+
+/**
+ * Maps the error of a blob operation, logging it.
+*/
+static DB_ERR
+BlobError(databaseADT db, const char *op, int rc)
+{
+    logError( db->logFile, "%s: %s", op, sqlite3_errmsg( db->dbHandle ) );
+
+    switch ( rc )
+    {
+        case SQLITE_ABORT:          /* The row was changed or deleted */
+            return DB_NO_MATCH;
+
+        case SQLITE_NOMEM:
+            return DB_NO_MEMORY;
+
+        case SQLITE_READONLY:
+            return DB_ACCESS_DENIED;
+
+        default:
+            return DB_INTERNAL_ERROR;
+    }
+}
+
+DB_ERR
+DBBlobOpen(databaseADT db, const char *column, long long rowid, int write,
+        blobADT *blob)
+{
+    int rc, n = 0;
+
+    if ( db == NULL || column == NULL || blob == NULL )
+        return DB_INVALID_ARG;
+
+    if ( ( *blob = malloc( sizeof( blobCDT ) ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    do
+    {
+        rc = sqlite3_blob_open( db->dbHandle, "main", "users", column, rowid,
+                            write ? 1 : 0, &( *blob )->blob );
+
+        if ( rc == SQLITE_BUSY || rc == SQLITE_LOCKED )
+            usleep( SQLTM_TIME );
+
+    } while ( ( ++n < SQLTM_COUNT ) && ( rc == SQLITE_BUSY || rc == SQLITE_LOCKED ) );
+
+    if ( rc != SQLITE_OK )
+    {
+        /* The handle is set even on failure */
+        sqlite3_blob_close( ( *blob )->blob );
+        free( *blob );
+        *blob = NULL;
+
+        /* No such row, or no such column */
+        if ( rc == SQLITE_ERROR )
+        {
+            logError( db->logFile, "DBBlobOpen: %s",
+                    sqlite3_errmsg( db->dbHandle ) );
+            return DB_NO_MATCH;
+        }
+
+        return BlobError( db, "DBBlobOpen", rc );
+    }
+
+    ( *blob )->db = db;
+    ( *blob )->rowid = rowid;
+    ( *blob )->written = FALSE;
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBBlobReopen(blobADT blob, long long rowid)
+{
+    int rc;
+
+    if ( blob == NULL )
+        return DB_INVALID_ARG;
+
+    if ( ( rc = sqlite3_blob_reopen( blob->blob, rowid ) ) != SQLITE_OK )
+        return ( rc == SQLITE_ERROR ) ? DB_NO_MATCH
+                                      : BlobError( blob->db, "DBBlobReopen", rc );
+
+    blob->rowid = rowid;
+    blob->written = FALSE;
+
+    return DB_SUCCESS;
+}
+
+int
+DBBlobSize(blobADT blob)
+{
+    return ( blob == NULL ) ? -1 : sqlite3_blob_bytes( blob->blob );
+}
+
+DB_ERR
+DBBlobRead(blobADT blob, void *buffer, int size, int offset)
+{
+    int rc;
+
+    if ( blob == NULL || buffer == NULL || size < 0 || offset < 0
+            || size > sqlite3_blob_bytes( blob->blob ) - offset )
+        return DB_INVALID_ARG;
+
+    if ( ( rc = sqlite3_blob_read( blob->blob, buffer, size, offset ) )
+            != SQLITE_OK )
+        return BlobError( blob->db, "DBBlobRead", rc );
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBBlobWrite(blobADT blob, const void *buffer, int size, int offset)
+{
+    int rc;
+
+    if ( blob == NULL || buffer == NULL || size < 0 || offset < 0
+            || size > sqlite3_blob_bytes( blob->blob ) - offset )
+        return DB_INVALID_ARG;
+
+    if ( ( rc = sqlite3_blob_write( blob->blob, buffer, size, offset ) )
+            != SQLITE_OK )
+        return BlobError( blob->db, "DBBlobWrite", rc );
+
+    /* Blob writes don't go through the update hook */
+    if ( !blob->written )
+    {
+        UpdateHook( blob->db, SQLITE_UPDATE, "main", "users", blob->rowid );
+        blob->written = TRUE;
+    }
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBBlobClose(blobADT blob)
+{
+    databaseADT db;
+    int rc;
+
+    if ( blob == NULL )
+        return DB_SUCCESS;
+
+    db = blob->db;
+    rc = sqlite3_blob_close( blob->blob );
+    free( blob );
+
+    /* Outside a transaction closing the blob commits the writes */
+    ChangeEndStatement( db, rc, db->stagedCount );
+
+    return ( rc == SQLITE_OK ) ? DB_SUCCESS : BlobError( db, "DBBlobClose", rc );
+}
+
+/**
+ * Binds the user, password and mail of an upsert and runs it.
+*/
+static DB_ERR
+UpsertUser(databaseADT db, sqlite3_stmt *statement, const char *user,
+        const char *password, const char *mail)
+{
+    int ret;
+
+    sqlite3_bind_text( statement, 1, user, -1, SQLITE_STATIC );
+    sqlite3_bind_blob( statement, 2, password, strlen( password ) + 1,
+                    SQLITE_STATIC );
+    sqlite3_bind_text( statement, 3, mail, -1, SQLITE_STATIC );
+
+    ret = StepSql( db, statement );
+    DBReleaseStatement( statement );
+
+    return ( ret == SQLITE_DONE ) ? DB_SUCCESS : DB_INTERNAL_ERROR;
+}
+
+DB_ERR
+DBupsertUser(databaseADT db, const char *user, const char *password,
+            const char *mail)
+{
+    sqlite3_stmt *statement;
+    DB_ERR err;
+
+    if (db == NULL || user == NULL || password == NULL || mail == NULL)
+        return DB_INVALID_ARG;
+
+    if ( ( err = DBPrepareCached( db, upsertUserSql, &statement ) )
+            != DB_SUCCESS )
+        return err;
+
+    return UpsertUser( db, statement, user, password, mail );
+}
+
+DB_ERR
+DBupsertUsers(databaseADT db, const char * const *users,
+            const char * const *passwords, const char * const *mails,
+            int count)
+{
+    sqlite3_stmt *statement;
+    DB_ERR err = DB_SUCCESS, released;
+    int i, outermost;
+
+    if ( db == NULL || users == NULL || passwords == NULL || mails == NULL
+            || count < 0 )
+        return DB_INVALID_ARG;
+
+    for ( i = 0; i < count; i++ )
+        if ( users[i] == NULL || passwords[i] == NULL || mails[i] == NULL )
+            return DB_INVALID_ARG;
+
+    /* A savepoint, unlike BEGIN, nests in a transaction of the caller */
+    outermost = sqlite3_get_autocommit( db->dbHandle );
+
+    if ( ( err = ExecSql( db, "SAVEPOINT upsert_users" ) ) != DB_SUCCESS )
+        return err;
+
+    for ( i = 0; i < count && err == DB_SUCCESS; i++ )
+        if ( ( err = DBPrepareCached( db, upsertUserSql, &statement ) )
+                == DB_SUCCESS )
+            err = UpsertUser( db, statement, users[i], passwords[i],
+                            mails[i] );
+
+    if ( err != DB_SUCCESS )
+        ExecSql( db, "ROLLBACK TO upsert_users" );
+
+    /* Releasing the outermost savepoint commits, which may fail */
+    if ( ( released = ExecSql( db, "RELEASE upsert_users" ) ) != DB_SUCCESS )
+    {
+        if ( outermost && !sqlite3_get_autocommit( db->dbHandle ) )
+            sqlite3_exec( db->dbHandle, "ROLLBACK", NULL, NULL, NULL );
+
+        if ( err == DB_SUCCESS )
+            err = released;
+    }
+
+    return err;
+}
+
+DB_ERR
+DBupdateUserFields(databaseADT db, const char *user, int fields,
+                const char *password, const char *mail)
+{
+    sqlite3_stmt *statement;
+    DB_ERR err;
+    int ret;
+
+    if ( db == NULL || user == NULL
+            || ( fields & ~( DB_USER_PASSWORD | DB_USER_MAIL ) ) != 0
+            || ( ( fields & DB_USER_PASSWORD ) && password == NULL )
+            || ( ( fields & DB_USER_MAIL ) && mail == NULL ) )
+        return DB_INVALID_ARG;
+
+    if ( ( err = DBPrepareCached( db, updateUserFieldsSql, &statement ) )
+            != DB_SUCCESS )
+        return err;
+
+    sqlite3_bind_int( statement, 1, fields );
+    if ( fields & DB_USER_PASSWORD )
+        sqlite3_bind_blob( statement, 2, password, strlen( password ) + 1,
+                        SQLITE_STATIC );
+    if ( fields & DB_USER_MAIL )
+        sqlite3_bind_text( statement, 3, mail, -1, SQLITE_STATIC );
+    sqlite3_bind_text( statement, 4, user, -1, SQLITE_STATIC );
+
+    ret = StepSql( db, statement );
+    DBReleaseStatement( statement );
+
+    if ( ret != SQLITE_DONE )
+        return DB_INTERNAL_ERROR;
+
+    return ( sqlite3_changes( db->dbHandle ) > 0 ) ? DB_SUCCESS : DB_NO_MATCH;
+}
+
+static void
+CopyField(char *dst, const char *src, int maxLen)
+{
+    if ( src == NULL )
+        src = "";
+
+    strncpy(dst, src, maxLen);
+    dst[maxLen-1] = 0;
+}
+
+static DB_ERR
+EnqueueUser(queueADT queue, const char *name, const char *pass,
+            const char *mail)
+{
+    user_t row, *uq = &row;
+
+    /* Pointer queues adopt a malloc'd copy, sized ones copy the row */
+    if ( queueElemSize( queue ) == 0
+            && ( uq = malloc( sizeof( user_t ) ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    CopyField(uq->name, name, USER_NAME_MAX_LEN);
+    CopyField(uq->pass, pass, USER_PASS_MAX_LEN);
+    CopyField(uq->mail, mail, USER_MAIL_MAX_LEN);
+
+    if ( uq == &row )
+        return enqueue( queue, uq ) ? DB_SUCCESS : DB_NO_MEMORY;
+
+    if ( !enqueueTake( queue, uq ) )
+    {
+        free( uq );
+        return DB_NO_MEMORY;
+    }
+
+    return DB_SUCCESS;
+}
+
+static DB_ERR
+QueueFromCache(databaseADT db, queueADT queue, const char *sqlSelect)
+{
+    resultSetADT rs;
+    DB_ERR err;
+    int i;
+
+    if ( ( err = CachedQuery( db, sqlSelect, 0, NULL, 3, &rs ) ) != DB_SUCCESS )
+        return err;
+
+    for ( i = 0; i < RSRowCount( rs ) && err == DB_SUCCESS; i++ )
+        err = EnqueueUser( queue, RSGetText( rs, i, 0 ), RSGetText( rs, i, 1 ),
+                        RSGetText( rs, i, 2 ) );
+
+    FreeResultSet( rs );
+    return err;
+}
+
+DB_ERR
+DBgetUserQueue(databaseADT db, queueADT queue)
+{
+    sqlite3_stmt *statement;
+    int ret;
+    DB_ERR err;
+    char *sqlSelect = "SELECT user, password, email FROM users";
+
+    if ( db == NULL || queue == NULL )
+        return DB_INVALID_ARG;
+
+    /* Sized queues must hold whole users */
+    if ( queueElemSize( queue ) != 0
+            && queueElemSize( queue ) != sizeof( user_t ) )
+        return DB_INVALID_ARG;
+
+    if ( db->cacheMax > 0 )
+        return QueueFromCache( db, queue, sqlSelect );
+
+    ret = QueryExecute( db, &statement, sqlSelect, 0, NULL, 0 );
+
+    while ( ret == SQLITE_ROW )
+    {
+        err = EnqueueUser( queue, (char *) sqlite3_column_text( statement, 0 ),
+                        (char *) sqlite3_column_text( statement, 1 ),
+                        (char *) sqlite3_column_text( statement, 2 ) );
+
+        if ( err != DB_SUCCESS )
+        {
+            FinalizeSql( db, statement );
+            return err;
+        }
+
+        ret = sqlite3_step( statement );
+    }
+
+    FinalizeSql( db, statement );
+
+    if ( ret != SQLITE_DONE )
+        return DB_INTERNAL_ERROR;
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBgetUserResultSet(databaseADT db, resultSetADT *result)
+{
+    sqlite3_stmt *statement = NULL;
+    int ret;
+    DB_ERR err;
+    char *sqlSelect = "SELECT user, password, email FROM users";
+
+    if ( db == NULL || result == NULL )
+        return DB_INVALID_ARG;
+
+    if ( db->cacheMax > 0 )
+        return CachedQuery( db, sqlSelect, 0, NULL, 3, result );
+
+    if ( ( *result = NewResultSet( 3 ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    ret = QueryExecute( db, &statement, sqlSelect, 0, NULL, 0 );
+
+    if ( ( err = FetchResultSet( db, statement, ret, *result ) ) != DB_SUCCESS )
+    {
+        FreeResultSet( *result );
+        *result = NULL;
+    }
+
+    return err;
+}
+
+/**
+ * State shared by the threads of DBStreamUsers. status is set once, by
+ * the first thread that stops the stream.
+*/
+typedef struct userStream
+{
+    databaseADT db;
+    concQueueADT queue;
+    DBUserRowFn fn;
+    void *ctx;
+    _Atomic int status;
+} userStream;
+
+/**
+ * Copies the current row of statement, and its fields, in a single block.
+*/
+static DBUserRow *
+StreamRow( sqlite3_stmt *statement )
+{
+    DBUserRow *row;
+    const char *user, *mail;
+    int userLen, passLen, mailLen;
+    char *data;
+
+    /* Text is converted before asking for its length */
+    user = ( const char * ) sqlite3_column_text( statement, 1 );
+    userLen = sqlite3_column_bytes( statement, 1 );
+    passLen = sqlite3_column_bytes( statement, 2 );
+    mail = ( const char * ) sqlite3_column_text( statement, 3 );
+    mailLen = sqlite3_column_bytes( statement, 3 );
+
+    if ( ( row = malloc( sizeof( DBUserRow ) + userLen + passLen + mailLen + 3 ) )
+            == NULL )
+        return NULL;
+
+    data = ( char * ) ( row + 1 );
+
+    row->id = sqlite3_column_int64( statement, 0 );
+
+    row->user = data;
+    memcpy( data, user != NULL ? user : "", userLen );
+    data[userLen] = '\0';
+    data += userLen + 1;
+
+    row->password = data;
+    row->passwordLen = passLen;
+    if ( passLen > 0 )
+        memcpy( data, sqlite3_column_blob( statement, 2 ), passLen );
+    data[passLen] = '\0';
+    data += passLen + 1;
+
+    row->mail = data;
+    memcpy( data, mail != NULL ? mail : "", mailLen );
+    data[mailLen] = '\0';
+
+    return row;
+}
+
+/**
+ * Stops the stream with status unless it was already stopped, and wakes
+ * up every thread waiting on the queue.
+*/
+static void
+StreamStop( userStream *stream, DB_ERR status )
+{
+    int expected = DB_SUCCESS;
+
+    atomic_compare_exchange_strong( &stream->status, &expected, status );
+    concClose( stream->queue );
+}
+
+/**
+ * Producer thread of DBStreamUsers: reads the users into the queue.
+*/
+static void *
+StreamProducer( void *arg )
+{
+    userStream *stream = arg;
+    sqlite3_stmt *statement = NULL;
+    DBUserRow *row;
+    int ret;
+
+    ret = QueryExecute( stream->db, &statement,
+                    "SELECT id, user, password, email FROM users", 0, NULL, 0 );
+
+    /* QueryExecute returns a DB_ERR if it couldn't build the query */
+    if ( statement == NULL && ret != SQLITE_MISUSE )
+    {
+        StreamStop( stream, (DB_ERR) ret );
+        concClose( stream->queue );
+        return NULL;
+    }
+
+    while ( ret == SQLITE_ROW )
+    {
+        if ( ( row = StreamRow( statement ) ) == NULL )
+        {
+            StreamStop( stream, DB_NO_MEMORY );
+            break;
+        }
+
+        /* Waits while the queue is full, fails once it is closed */
+        if ( !concEnqueue( stream->queue, row ) )
+        {
+            free( row );
+            break;
+        }
+
+        ret = StepSql( stream->db, statement );
+    }
+
+    FinalizeSql( stream->db, statement );
+
+    if ( ret != SQLITE_DONE && ret != SQLITE_ROW )
+        StreamStop( stream, DB_INTERNAL_ERROR );
+
+    /* End of stream: consumers finish once the queue is empty */
+    concClose( stream->queue );
+
+    return NULL;
+}
+
+/**
+ * Consumer of DBStreamUsers: calls fn for every user in the queue.
+*/
+static void *
+StreamConsumer( void *arg )
+{
+    userStream *stream = arg;
+    queueElemT rows[STREAM_BATCH];
+    int i, n;
+
+    for ( ;; )
+    {
+        if ( ( n = concDequeueBatch( stream->queue, rows, STREAM_BATCH ) ) == 0 )
+        {
+            if ( !concDequeue( stream->queue, &rows[0] ) )
+                break;
+            n = 1;
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            if ( atomic_load( &stream->status ) == DB_SUCCESS
+                    && stream->fn( rows[i], stream->ctx ) != 0 )
+                StreamStop( stream, DB_CANCELLED );
+
+            free( rows[i] );
+        }
+    }
+
+    return NULL;
+}
+
+DB_ERR
+DBStreamUsers(databaseADT db, int consumers, int queueSize, DBUserRowFn fn,
+            void *ctx)
+{
+    userStream stream;
+    pthread_t producer, *threads = NULL;
+    int i, started = 0;
+
+    if ( db == NULL || consumers < 0 || queueSize <= 0 || fn == NULL )
+        return DB_INVALID_ARG;
+
+    if ( consumers > 0
+            && ( threads = malloc( consumers * sizeof( pthread_t ) ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    /* Rows are adopted by the queue and freed by the consumers */
+    if ( ( stream.queue = newConcQueue( queueSize, NULL, free ) ) == NULL )
+    {
+        free( threads );
+        return DB_NO_MEMORY;
+    }
+
+    stream.db = db;
+    stream.fn = fn;
+    stream.ctx = ctx;
+    atomic_init( &stream.status, DB_SUCCESS );
+
+    if ( pthread_create( &producer, NULL, StreamProducer, &stream ) != 0 )
+    {
+        freeConcQueue( stream.queue );
+        free( threads );
+        return DB_INTERNAL_ERROR;
+    }
+
+    for ( started = 0; started < consumers; started++ )
+        if ( pthread_create( &threads[started], NULL, StreamConsumer,
+                            &stream ) != 0 )
+        {
+            StreamStop( &stream, DB_INTERNAL_ERROR );
+            break;
+        }
+
+    /* Without consumer threads, or if none started, consume from here */
+    if ( started == 0 )
+        StreamConsumer( &stream );
+
+    for ( i = 0; i < started; i++ )
+        pthread_join( threads[i], NULL );
+
+    pthread_join( producer, NULL );
+
+    freeConcQueue( stream.queue );
+    free( threads );
+
+    return atomic_load( &stream.status );
+}
+
+static DB_ERR
+FetchResultSet( databaseADT db, sqlite3_stmt *statement, int ret,
+                resultSetADT rs )
+{
+    const void *fields[RSColumnCount( rs )];
+    int lengths[RSColumnCount( rs )];
+    int i;
+
+    while ( ret == SQLITE_ROW )
+    {
+        for ( i = 0; i < RSColumnCount( rs ); i++ )
+        {
+            /* Text is converted before asking for its length */
+            if ( sqlite3_column_type( statement, i ) == SQLITE_BLOB )
+                fields[i] = sqlite3_column_blob( statement, i );
+            else
+                fields[i] = sqlite3_column_text( statement, i );
+
+            lengths[i] = sqlite3_column_bytes( statement, i );
+        }
+
+        if ( !RSAppendRow( rs, fields, lengths ) )
+        {
+            logError( db->logFile, "Not enough memory in FetchResultSet." );
+            FinalizeSql( db, statement );
+            return DB_NO_MEMORY;
+        }
+
+        ret = sqlite3_step( statement );
+    }
+
+    FinalizeSql( db, statement );
+
+    if ( ret != SQLITE_DONE )
+        return DB_INTERNAL_ERROR;
+
+    return DB_SUCCESS;
+}
+
+static int
+UserSearchIndex(databaseADT db)
+{
+    sqlite3_stmt *statement = NULL;
+    int exists;
+
+    /* An existing users_fts table is no use without FTS5 */
+    if ( !sqlite3_compileoption_used( "ENABLE_FTS5" ) )
+        return -1;
+
+    if ( PrepareSql( db, "SELECT 1 FROM sqlite_master WHERE name = 'users_fts'",
+                    -1, &statement, NULL ) != SQLITE_OK )
+        return 0;
+
+    exists = ( StepSql( db, statement ) == SQLITE_ROW );
+    FinalizeSql( db, statement );
+
+    return exists;
+}
+
+DB_ERR
+DBEnableUserSearch(databaseADT db)
+{
+    /* An external content table: it only stores the trigram index */
+    static const char *ftsSql[] = {
+        "CREATE VIRTUAL TABLE IF NOT EXISTS users_fts USING fts5(user, email, "
+        "content='users', content_rowid='id', tokenize='trigram')",
+        "CREATE TRIGGER IF NOT EXISTS users_fts_insert AFTER INSERT ON users "
+        "BEGIN INSERT INTO users_fts(rowid, user, email) "
+        "VALUES (new.id, new.user, new.email); END",
+        "CREATE TRIGGER IF NOT EXISTS users_fts_delete AFTER DELETE ON users "
+        "BEGIN INSERT INTO users_fts(users_fts, rowid, user, email) "
+        "VALUES ('delete', old.id, old.user, old.email); END",
+        "CREATE TRIGGER IF NOT EXISTS users_fts_update "
+        "AFTER UPDATE OF user, email ON users BEGIN "
+        "INSERT INTO users_fts(users_fts, rowid, user, email) "
+        "VALUES ('delete', old.id, old.user, old.email); "
+        "INSERT INTO users_fts(rowid, user, email) "
+        "VALUES (new.id, new.user, new.email); END",
+        "INSERT INTO users_fts(users_fts) VALUES ('rebuild')"
+    };
+    int index = 0, i;
+    DB_ERR err;
+
+    if ( db == NULL )
+        return DB_INVALID_ARG;
+
+    /* Unlike BEGIN, a savepoint nests in a transaction of the caller */
+    if ( ( err = ExecSql( db, "SAVEPOINT user_search" ) ) != DB_SUCCESS )
+        return err;
+
+    /* Prefix searches on the name use the UNIQUE(user) index */
+    err = ExecSql( db, "CREATE INDEX IF NOT EXISTS users_email_idx "
+                    "ON users(email)" );
+
+    if ( err == DB_SUCCESS && ( index = UserSearchIndex( db ) ) == 0 )
+    {
+        for ( i = 0; i < sizeof( ftsSql ) / sizeof( ftsSql[0] )
+                    && err == DB_SUCCESS; i++ )
+            err = ExecSql( db, ftsSql[i] );
+
+        index = 1;
+    }
+
+    if ( err != DB_SUCCESS )
+        ExecSql( db, "ROLLBACK TO user_search" );
+
+    ExecSql( db, "RELEASE user_search" );
+
+    if ( err != DB_SUCCESS )
+        return err;
+
+    if ( index < 0 )
+        logError( db->logFile, "DBEnableUserSearch: SQLite was compiled "
+                "without FTS5, substring searches will scan the whole table." );
+
+    db->searchIndex = index;
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBsearchUsers(databaseADT db, const char *pattern, DB_SEARCH_MODE mode,
+        int limit, long long *cursor, resultSetADT *result)
+{
+    sqlite3_stmt *statement = NULL;
+    const char *sql;
+    char *upper = NULL, *match = NULL;
+    int ret, i, j, len;
+    DB_ERR err;
+
+    if ( db == NULL || pattern == NULL || result == NULL || limit < 0
+            || ( mode != DB_SEARCH_PREFIX && mode != DB_SEARCH_SUBSTRING ) )
+        return DB_INVALID_ARG;
+
+    /* Rechecked until the index shows up, DBEnableUserSearch builds it */
+    if ( db->searchIndex == 0 )
+        db->searchIndex = UserSearchIndex( db );
+
+    len = strlen( pattern );
+
+    if ( mode == DB_SEARCH_PREFIX )
+    {
+        /* Everything in [pattern, upper) starts with pattern. upper is */
+        /* pattern with its last byte incremented, dropping 0xFF bytes.  */
+        if ( ( upper = strdup( pattern ) ) == NULL )
+            return DB_NO_MEMORY;
+
+        for ( i = len - 1; i >= 0 && (unsigned char) upper[i] == 0xFF; i-- )
+            upper[i] = '\0';
+
+        if ( i >= 0 )
+            upper[i]++;
+
+        sql = ( i >= 0 )
+            ? "SELECT id, user, email FROM users WHERE id > ?3 AND "
+              "((user >= ?1 AND user < ?2) OR (email >= ?1 AND email < ?2)) "
+              "ORDER BY id LIMIT ?4"
+            : "SELECT id, user, email FROM users WHERE id > ?3 AND "
+              "(user >= ?1 OR email >= ?1) ORDER BY id LIMIT ?4";
+    }
+    else if ( db->searchIndex == 1 && len >= 3 )
+    {
+        /* Match the pattern as a single phrase, quotes are doubled */
+        if ( ( match = malloc( 2 * len + 3 ) ) == NULL )
+            return DB_NO_MEMORY;
+
+        for ( i = 0, j = 0, match[j++] = '"'; i < len; i++ )
+        {
+            if ( pattern[i] == '"' )
+                match[j++] = '"';
+            match[j++] = pattern[i];
+        }
+
+        match[j++] = '"';
+        match[j] = '\0';
+
+        sql = "SELECT u.id, u.user, u.email FROM users_fts f "
+              "JOIN users u ON u.id = f.rowid "
+              "WHERE users_fts MATCH ?1 AND f.rowid > ?3 "
+              "ORDER BY f.rowid LIMIT ?4";
+    }
+    else
+    {
+        /* Trigrams can't index patterns shorter than 3 characters */
+        sql = "SELECT id, user, email FROM users WHERE id > ?3 AND "
+              "(instr(lower(user), lower(?1)) > 0 "
+              "OR instr(lower(email), lower(?1)) > 0) "
+              "ORDER BY id LIMIT ?4";
+    }
+
+    if ( PrepareSql( db, (char *) sql, -1, &statement, NULL ) != SQLITE_OK )
+    {
+        free( upper );
+        free( match );
+        return DB_INTERNAL_ERROR;
+    }
+
+    sqlite3_bind_text( statement, 1, ( match != NULL ) ? match : pattern, -1,
+                    SQLITE_STATIC );
+    if ( upper != NULL )
+        sqlite3_bind_text( statement, 2, upper, -1, SQLITE_STATIC );
+    sqlite3_bind_int64( statement, 3, ( cursor != NULL ) ? *cursor : 0 );
+    sqlite3_bind_int( statement, 4, ( limit > 0 ) ? limit : -1 );
+
+    if ( ( *result = NewResultSet( 3 ) ) == NULL )
+    {
+        FinalizeSql( db, statement );
+        free( upper );
+        free( match );
+        return DB_NO_MEMORY;
+    }
+
+    ret = StepSql( db, statement );
+    err = FetchResultSet( db, statement, ret, *result );
+
+    free( upper );
+    free( match );
+
+    if ( err != DB_SUCCESS )
+    {
+        FreeResultSet( *result );
+        *result = NULL;
+        return err;
+    }
+
+    if ( cursor != NULL && RSRowCount( *result ) > 0 )
+        RSGetInt64( *result, RSRowCount( *result ) - 1, 0, cursor );
+
+    return DB_SUCCESS;
+}
+
+static DB_ERR
+ExecSql( databaseADT db, const char *sql )
+{
+    char *errMsg = NULL;
+
+    int mark = db->stagedCount, rc, n = 0;
+
+    do
+    {
+        sqlite3_free( errMsg );
+        errMsg = NULL;
+
+        if ( ( rc = sqlite3_exec( db->dbHandle, sql, NULL, NULL, &errMsg ) )
+                == SQLITE_BUSY || rc == SQLITE_LOCKED )
+            usleep( SQLTM_TIME );
+
+    } while ( ( ++n < SQLTM_COUNT ) && ( rc == SQLITE_BUSY || rc == SQLITE_LOCKED )
+            && !CallExpired( db ) );
+
+    ChangeEndStatement( db, rc, mark );
+
+    if ( rc != SQLITE_OK )
+    {
+        logError( db->logFile, "Error executing \"%s\": %s", sql, errMsg );
+        sqlite3_free( errMsg );
+        return ( rc == SQLITE_BUSY || rc == SQLITE_LOCKED ) ? DB_TIMEOUT
+                                                            : DB_INTERNAL_ERROR;
+    }
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+DBSetQueryCache(databaseADT db, size_t maxBytes)
+{
+    if ( db == NULL )
+        return DB_INVALID_ARG;
+
+    db->cacheMax = maxBytes;
+
+    /* Shrink the cache to the new size, least recently used first */
+    while ( db->cacheLast != NULL && db->cacheUsed > db->cacheMax )
+        CacheRemove( db, db->cacheLast );
+
+    return DB_SUCCESS;
+}
+
+static DB_ERR
+CachedQuery( databaseADT db, const char *sql, int bindingCount,
+            blobBindings *bindings, int columns, resultSetADT *result )
+{
+    sqlite3_stmt *statement = NULL;
+    cacheEntry *entry;
+    char *key;
+    size_t keyLen, pos;
+    int i, ret;
+    DB_ERR err;
+
+    CacheCheckDataVersion( db );
+
+    /* Build the key: the SQL, its '\0' and every binding */
+    keyLen = strlen( sql ) + 1;
+    for ( i = 0; i < bindingCount; i++ )
+        keyLen += 2 * sizeof( int ) + bindings[i].size;
+
+    if ( ( key = malloc( keyLen ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    pos = strlen( sql ) + 1;
+    memcpy( key, sql, pos );
+
+    for ( i = 0; i < bindingCount; i++ )
+    {
+        memcpy( key + pos, &bindings[i].param, sizeof( int ) );
+        memcpy( key + pos + sizeof( int ), &bindings[i].size, sizeof( int ) );
+        pos += 2 * sizeof( int );
+        if ( bindings[i].data != NULL )
+            memcpy( key + pos, bindings[i].data, bindings[i].size );
+        else
+            memset( key + pos, 0, bindings[i].size );
+        pos += bindings[i].size;
+    }
+
+    for ( entry = db->cacheFirst; entry != NULL; entry = entry->next )
+        if ( entry->keyLen == keyLen && memcmp( entry->key, key, keyLen ) == 0 )
+            break;
+
+    if ( entry != NULL )
+    {
+        free( key );
+
+        if ( ( *result = RSClone( entry->rs ) ) == NULL )
+            return DB_NO_MEMORY;
+
+        /* Move it to the front */
+        if ( entry != db->cacheFirst )
+        {
+            entry->prev->next = entry->next;
+            if ( entry->next != NULL )
+                entry->next->prev = entry->prev;
+            else
+                db->cacheLast = entry->prev;
+
+            entry->prev = NULL;
+            entry->next = db->cacheFirst;
+            db->cacheFirst->prev = entry;
+            db->cacheFirst = entry;
+        }
+
+        return DB_SUCCESS;
+    }
+
+    if ( ( entry = calloc( 1, sizeof( cacheEntry ) ) ) == NULL
+            || ( entry->rs = NewResultSet( columns ) ) == NULL )
+    {
+        free( entry );
+        free( key );
+        return DB_NO_MEMORY;
+    }
+
+    entry->key = key;
+    entry->keyLen = keyLen;
+
+    /* Record the tables read by the query while it is prepared */
+    sqlite3_set_authorizer( db->dbHandle, CacheAuthorizer, entry );
+    ret = QueryExecute( db, &statement, sql, bindingCount, bindings, 0 );
+    sqlite3_set_authorizer( db->dbHandle, NULL, NULL );
+
+    if ( ( err = FetchResultSet( db, statement, ret, entry->rs ) ) != DB_SUCCESS
+            || ( *result = RSClone( entry->rs ) ) == NULL )
+    {
+        CacheFreeEntry( entry );
+        return ( err != DB_SUCCESS ) ? err : DB_NO_MEMORY;
+    }
+
+    entry->bytes = sizeof( cacheEntry ) + keyLen + RSMemoryUsage( entry->rs );
+
+    /* Results bigger than the whole cache are not worth keeping */
+    if ( entry->bytes > db->cacheMax )
+    {
+        CacheFreeEntry( entry );
+        return DB_SUCCESS;
+    }
+
+    while ( db->cacheLast != NULL && db->cacheUsed + entry->bytes > db->cacheMax )
+        CacheRemove( db, db->cacheLast );
+
+    entry->next = db->cacheFirst;
+    if ( db->cacheFirst != NULL )
+        db->cacheFirst->prev = entry;
+    else
+        db->cacheLast = entry;
+
+    db->cacheFirst = entry;
+    db->cacheUsed += entry->bytes;
+
+    return DB_SUCCESS;
+}
+
+static void
+CacheRemove( databaseADT db, cacheEntry *entry )
+{
+    if ( entry->prev != NULL )
+        entry->prev->next = entry->next;
+    else
+        db->cacheFirst = entry->next;
+
+    if ( entry->next != NULL )
+        entry->next->prev = entry->prev;
+    else
+        db->cacheLast = entry->prev;
+
+    db->cacheUsed -= entry->bytes;
+    CacheFreeEntry( entry );
+}
+
+static void
+CacheFreeEntry( cacheEntry *entry )
+{
+    int i;
+
+    for ( i = 0; i < entry->tableCount; i++ )
+        free( entry->tables[i] );
+
+    free( entry->tables );
+    FreeResultSet( entry->rs );
+    free( entry->key );
+    free( entry );
+}
+
+static void
+CacheFlush( databaseADT db )
+{
+    while ( db->cacheFirst != NULL )
+        CacheRemove( db, db->cacheFirst );
+}
+
+static void
+CacheCheckDataVersion( databaseADT db )
+{
+    sqlite3_int64 version;
+
+    if ( db->dataVersionStmt == NULL
+            && PrepareSql( db, "PRAGMA data_version", -1,
+                        &db->dataVersionStmt, NULL ) != SQLITE_OK )
+    {
+        CacheFlush( db );
+        return;
+    }
+
+    if ( StepSql( db, db->dataVersionStmt ) != SQLITE_ROW )
+    {
+        sqlite3_reset( db->dataVersionStmt );
+        CacheFlush( db );
+        return;
+    }
+
+    version = sqlite3_column_int64( db->dataVersionStmt, 0 );
+    sqlite3_reset( db->dataVersionStmt );
+
+    if ( version != db->dataVersion )
+        CacheFlush( db );
+
+    db->dataVersion = version;
+}
+
+static void
+UpdateHook( void *ctx, int op, const char *dbName, const char *table,
+            sqlite3_int64 rowid )
+{
+    databaseADT db = ctx;
+    cacheEntry *entry, *next;
+    int i;
+
+    for ( entry = db->cacheFirst; entry != NULL; entry = next )
+    {
+        next = entry->next;
+
+        for ( i = 0; i < entry->tableCount; i++ )
+            if ( strcmp( entry->tables[i], table ) == 0 )
+            {
+                CacheRemove( db, entry );
+                break;
+            }
+    }
+
+    if ( db->changes != NULL && strcmp( table, "users" ) == 0 )
+        ChangeStage( db, op, rowid );
+}
+
+static void
+RollbackHook( void *ctx )
+{
+    databaseADT db = ctx;
+
+    CacheFlush( db );
+    db->stagedCount = 0;
+}
+
+static void
+ChangeStage( databaseADT db, int op, sqlite3_int64 rowid )
+{
+    stagedChange *aux;
+    int size;
+
+    if ( db->stagedCount == db->stagedSize )
+    {
+        size = ( db->stagedSize > 0 ) ? 2 * db->stagedSize : 64;
+
+        if ( ( aux = realloc( db->staged, size * sizeof( stagedChange ) ) )
+                == NULL )
+        {
+            logError( db->logFile, "ChangeStage: not enough memory, change "
+                    "to user %lld lost", (long long) rowid );
+            return;
+        }
+
+        db->staged = aux;
+        db->stagedSize = size;
+    }
+
+    db->staged[db->stagedCount].op = ( op == SQLITE_INSERT ) ? DB_CHANGE_INSERT
+                        : ( op == SQLITE_UPDATE ) ? DB_CHANGE_UPDATE
+                        : DB_CHANGE_DELETE;
+    db->staged[db->stagedCount].rowid = rowid;
+    db->stagedCount++;
+}
+
+static void
+ChangeEndStatement( databaseADT db, int rc, int mark )
+{
+    changeRing *ring = db->changes;
+    changeSlot *slot;
+    unsigned long long seq;
+    int i;
+
+    /* Autocommit statements commit when they are done */
+    if ( db->stagedCount == 0 || rc == SQLITE_ROW )
+        return;
+
+    if ( !sqlite3_get_autocommit( db->dbHandle ) )
+    {
+        /* The statement was rolled back, not its transaction */
+        if ( rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK
+                && mark < db->stagedCount )
+            db->stagedCount = mark;
+
+        return;
+    }
+
+    seq = atomic_load_explicit( &ring->head, memory_order_relaxed );
+
+    for ( i = 0; i < db->stagedCount; i++ )
+    {
+        slot = &ring->slots[++seq & ( CHANGE_RING_SIZE - 1 )];
+
+        atomic_store_explicit( &slot->seq, 0, memory_order_relaxed );
+        atomic_thread_fence( memory_order_release );
+        atomic_store_explicit( &slot->op, db->staged[i].op,
+                            memory_order_relaxed );
+        atomic_store_explicit( &slot->rowid, db->staged[i].rowid,
+                            memory_order_relaxed );
+        atomic_store_explicit( &slot->seq, seq, memory_order_release );
+    }
+
+    /* The whole transaction becomes visible at once */
+    atomic_store_explicit( &ring->head, seq, memory_order_release );
+    db->stagedCount = 0;
+}
+
+DB_ERR
+DBSubscribeChanges(databaseADT db, unsigned long long fromSeq,
+                changeSubADT *sub)
+{
+    unsigned long long head;
+
+    if ( db == NULL || sub == NULL )
+        return DB_INVALID_ARG;
+
+    if ( db->changes == NULL
+            && ( db->changes = calloc( 1, sizeof( changeRing ) ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    if ( ( *sub = malloc( sizeof( changeSubCDT ) ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    head = atomic_load_explicit( &db->changes->head, memory_order_acquire );
+
+    ( *sub )->ring = db->changes;
+    ( *sub )->next = ( fromSeq == 0 ) ? head + 1 : fromSeq;
+
+    return DB_SUCCESS;
+}
+
+int
+DBReadChanges(changeSubADT sub, DBChange *changes, int max,
+            unsigned long long *lost)
+{
+    changeSlot *slot;
+    unsigned long long head, seq, skipped = 0;
+    long long rowid;
+    int n = 0, op;
+
+    if ( lost != NULL )
+        *lost = 0;
+
+    if ( sub == NULL || changes == NULL || max <= 0 )
+        return 0;
+
+    while ( n < max )
+    {
+        head = atomic_load_explicit( &sub->ring->head, memory_order_acquire );
+
+        if ( sub->next > head )
+            break;
+
+        if ( head - sub->next >= CHANGE_RING_SIZE )
+        {
+            /* Lost changes are reported before the ones returned */
+            if ( n > 0 )
+                break;
+
+            skipped += head - CHANGE_RING_SIZE + 1 - sub->next;
+            sub->next = head - CHANGE_RING_SIZE + 1;
+        }
+
+        slot = &sub->ring->slots[sub->next & ( CHANGE_RING_SIZE - 1 )];
+
+        seq = atomic_load_explicit( &slot->seq, memory_order_acquire );
+        op = atomic_load_explicit( &slot->op, memory_order_relaxed );
+        rowid = atomic_load_explicit( &slot->rowid, memory_order_relaxed );
+        atomic_thread_fence( memory_order_acquire );
+
+        /* Overwritten while it was copied, head will show it */
+        if ( seq != sub->next
+                || atomic_load_explicit( &slot->seq, memory_order_relaxed )
+                    != seq )
+        {
+            if ( n > 0 )
+                break;
+
+            continue;
+        }
+
+        changes[n].seq = seq;
+        changes[n].op = op;
+        changes[n].rowid = rowid;
+        n++;
+        sub->next++;
+    }
+
+    if ( lost != NULL )
+        *lost = skipped;
+
+    return n;
+}
+
+void
+DBUnsubscribeChanges(changeSubADT sub)
+{
+    free( sub );
+}
+
+static int
+CacheAuthorizer( void *ctx, int action, const char *arg1, const char *arg2,
+                const char *dbName, const char *trigger )
+{
+    cacheEntry *entry = ctx;
+    char **aux;
+    int i;
+
+    if ( action != SQLITE_READ || arg1 == NULL )
+        return SQLITE_OK;
+
+    for ( i = 0; i < entry->tableCount; i++ )
+        if ( strcmp( entry->tables[i], arg1 ) == 0 )
+            return SQLITE_OK;
+
+    if ( ( aux = realloc( entry->tables,
+                    ( entry->tableCount + 1 ) * sizeof( char * ) ) ) == NULL )
+        return SQLITE_DENY;
+
+    entry->tables = aux;
+
+    if ( ( entry->tables[entry->tableCount] = strdup( arg1 ) ) == NULL )
+        return SQLITE_DENY;
+
+    entry->tableCount++;
+
+    return SQLITE_OK;
+}
+
+static unsigned long
+HashSql( const char *sql )
+{
+    unsigned long hash = 2166136261UL;
+
+    /* FNV-1a */
+    for ( ; *sql; sql++ )
+        hash = ( hash ^ (unsigned char) *sql ) * 16777619UL;
+
+    return hash;
+}
+
+DB_ERR
+DBPrepareCached(databaseADT db, const char *sql, sqlite3_stmt **statement)
+{
+    stmtCacheEntry *entry = NULL;
+    unsigned long hash;
+    char *copy;
+    int i, rc, n = 0;
+
+    if ( db == NULL || sql == NULL || statement == NULL )
+        return DB_INVALID_ARG;
+
+    hash = HashSql( sql );
+
+    /* A running entry belongs to an outer caller, such as a DBforEach */
+    /* calling DBforEach with the same SQL: it is never reset here      */
+    for ( i = 0; i < db->stmtCount; i++ )
+        if ( db->stmtCache[i].hash == hash
+                && strcmp( db->stmtCache[i].sql, sql ) == 0
+                && !sqlite3_stmt_busy( db->stmtCache[i].statement ) )
+        {
+            entry = &db->stmtCache[i];
+            entry->lastUse = ++db->stmtUses;
+            *statement = entry->statement;
+            sqlite3_reset( *statement );
+            sqlite3_clear_bindings( *statement );
+            return DB_SUCCESS;
+        }
+
+    if ( db->stmtCount < STMT_CACHE_SIZE )
+        entry = &db->stmtCache[db->stmtCount];
+    else
+    {
+        /* Full: evict the least recently used entry that isn't running */
+        for ( i = 0; i < db->stmtCount; i++ )
+            if ( !sqlite3_stmt_busy( db->stmtCache[i].statement )
+                    && ( entry == NULL
+                        || db->stmtCache[i].lastUse < entry->lastUse ) )
+                entry = &db->stmtCache[i];
+
+        if ( entry == NULL )
+        {
+            logError( db->logFile, "DBPrepareCached: every cached statement "
+                    "is running." );
+            return DB_NO_MEMORY;
+        }
+    }
+
+    if ( ( copy = strdup( sql ) ) == NULL )
+        return DB_NO_MEMORY;
+
+    do
+    {
+        rc = sqlite3_prepare_v3( db->dbHandle, sql, -1,
+                                SQLITE_PREPARE_PERSISTENT, statement, NULL );
+
+        if ( rc == SQLITE_BUSY || rc == SQLITE_LOCKED )
+            usleep( SQLTM_TIME );
+
+    } while ( ( ++n < SQLTM_COUNT ) && ( rc == SQLITE_BUSY || rc == SQLITE_LOCKED ) );
+
+    if ( rc != SQLITE_OK )
+    {
+        logError( db->logFile, "DBPrepareCached: can't prepare \"%s\": %s",
+                sql, sqlite3_errmsg( db->dbHandle ) );
+        free( copy );
+        return DB_INTERNAL_ERROR;
+    }
+
+    if ( entry == &db->stmtCache[db->stmtCount] )
+        db->stmtCount++;
+    else
+    {
+        FinalizeSql( db, entry->statement );
+        free( entry->sql );
+    }
+
+    entry->sql = copy;
+    entry->hash = hash;
+    entry->lastUse = ++db->stmtUses;
+    entry->statement = *statement;
+
+    return DB_SUCCESS;
+}
+
+int
+DBStepStatement(databaseADT db, sqlite3_stmt *statement)
+{
+    return StepSql( db, statement );
+}
+
+void
+DBReleaseStatement(sqlite3_stmt *statement)
+{
+    sqlite3_reset( statement );
+}
+
+DB_ERR
+DBStartCheckpointer(databaseADT db, const DBCheckpointConfig *config)
+{
+    checkpointer *ckpt;
+    sqlite3_stmt *statement = NULL;
+    char pragma[64];
+    int wal;
+
+    if ( db == NULL || config == NULL || config->intervalMs <= 0
+            || db->ckpt != NULL )
+        return DB_INVALID_ARG;
+
+    if ( config->enableWal
+            && sqlite3_exec( db->dbHandle, "PRAGMA journal_mode=WAL",
+                            NULL, NULL, NULL ) != SQLITE_OK )
+    {
+        logError( db->logFile, "DBStartCheckpointer: can't enable WAL: %s",
+                sqlite3_errmsg( db->dbHandle ) );
+        return DB_INTERNAL_ERROR;
+    }
+
+    if ( PrepareSql( db, "PRAGMA journal_mode", -1, &statement, NULL )
+            != SQLITE_OK )
+        return DB_INTERNAL_ERROR;
+
+    wal = StepSql( db, statement ) == SQLITE_ROW && strcmp( "wal",
+            (const char *) sqlite3_column_text( statement, 0 ) ) == 0;
+    FinalizeSql( db, statement );
+
+    if ( !wal )
+        return DB_INVALID_ARG;
+
+    if ( ( ckpt = calloc( 1, sizeof( checkpointer ) ) ) == NULL
+            || ( ckpt->walFile = malloc( strlen( db->dbFile ) + 5 ) ) == NULL )
+    {
+        free( ckpt );
+        return DB_NO_MEMORY;
+    }
+
+    sprintf( ckpt->walFile, "%s-wal", db->dbFile );
+    ckpt->logFile = db->logFile;
+    ckpt->config = *config;
+
+    /* The thread uses its own connection, so it never holds this one. */
+    /* Checkpoints are no-ops until the connection has opened the WAL.  */
+    if ( sqlite3_open_v2( db->dbFile, &ckpt->dbHandle, SQLITE_OPEN_READWRITE,
+                        db->vfsName ) != SQLITE_OK
+            || sqlite3_exec( ckpt->dbHandle, "PRAGMA journal_mode=WAL",
+                            NULL, NULL, NULL ) != SQLITE_OK )
+    {
+        logError( db->logFile, "DBStartCheckpointer: can't open database: %s",
+                sqlite3_errmsg( ckpt->dbHandle ) );
+        sqlite3_close( ckpt->dbHandle );
+        free( ckpt->walFile );
+        free( ckpt );
+        return DB_INTERNAL_ERROR;
+    }
+
+    if ( PrepareSql( db, "PRAGMA page_size", -1, &statement, NULL )
+            == SQLITE_OK && StepSql( db, statement ) == SQLITE_ROW )
+        ckpt->pageSize = sqlite3_column_int( statement, 0 );
+    FinalizeSql( db, statement );
+
+    /* Only RESTART and TRUNCATE checkpoints wait for other connections */
+    sqlite3_busy_timeout( ckpt->dbHandle, config->intervalMs );
+
+    pthread_mutex_init( &ckpt->lock, NULL );
+    pthread_cond_init( &ckpt->cond, NULL );
+
+    if ( pthread_create( &ckpt->thread, NULL, CheckpointerMain, ckpt ) != 0 )
+    {
+        pthread_mutex_destroy( &ckpt->lock );
+        pthread_cond_destroy( &ckpt->cond );
+        sqlite3_close( ckpt->dbHandle );
+        free( ckpt->walFile );
+        free( ckpt );
+        return DB_INTERNAL_ERROR;
+    }
+
+    /* Shrink the WAL file whenever the log is restarted */
+    if ( config->walSizeLimit > 0 )
+    {
+        ckpt->sizeLimit = -1;
+
+        if ( PrepareSql( db, "PRAGMA journal_size_limit", -1, &statement,
+                        NULL ) == SQLITE_OK
+                && StepSql( db, statement ) == SQLITE_ROW )
+            ckpt->sizeLimit = sqlite3_column_int64( statement, 0 );
+        FinalizeSql( db, statement );
+
+        snprintf( pragma, sizeof( pragma ), "PRAGMA journal_size_limit=%ld",
+                WAL_RESTART_FACTOR * config->walSizeLimit );
+        sqlite3_exec( db->dbHandle, pragma, NULL, NULL, NULL );
+    }
+
+    /* Replaces, and so disables, the automatic checkpoints */
+    sqlite3_wal_hook( db->dbHandle, WalHook, ckpt );
+    db->ckpt = ckpt;
+
+    return DB_SUCCESS;
+}
+
+void
+DBStopCheckpointer(databaseADT db)
+{
+    checkpointer *ckpt;
+    char pragma[64];
+
+    if ( db == NULL || ( ckpt = db->ckpt ) == NULL )
+        return;
+
+    /* Back to the default automatic checkpoints */
+    sqlite3_wal_autocheckpoint( db->dbHandle, 1000 );
+
+    pthread_mutex_lock( &ckpt->lock );
+    ckpt->stop = TRUE;
+    pthread_cond_signal( &ckpt->cond );
+    pthread_mutex_unlock( &ckpt->lock );
+
+    pthread_join( ckpt->thread, NULL );
+
+    if ( ckpt->config.walSizeLimit > 0 )
+    {
+        snprintf( pragma, sizeof( pragma ), "PRAGMA journal_size_limit=%lld",
+                ckpt->sizeLimit );
+        sqlite3_exec( db->dbHandle, pragma, NULL, NULL, NULL );
+    }
+
+    pthread_mutex_destroy( &ckpt->lock );
+    pthread_cond_destroy( &ckpt->cond );
+    sqlite3_close( ckpt->dbHandle );
+    free( ckpt->walFile );
+    free( ckpt );
+    db->ckpt = NULL;
+}
+
+DB_ERR
+DBGetCheckpointStats(databaseADT db, DBCheckpointStats *stats)
+{
+    if ( db == NULL || stats == NULL || db->ckpt == NULL )
+        return DB_INVALID_ARG;
+
+    pthread_mutex_lock( &db->ckpt->lock );
+    *stats = db->ckpt->stats;
+    pthread_mutex_unlock( &db->ckpt->lock );
+
+    return DB_SUCCESS;
+}
+
+static int
+WalHook( void *ctx, sqlite3 *handle, const char *dbName, int pages )
+{
+    checkpointer *ckpt = ctx;
+    long long limit = ckpt->config.walSizeLimit, before;
+
+    pthread_mutex_lock( &ckpt->lock );
+
+    before = ckpt->walBytes;
+    ckpt->commits++;
+    ckpt->walBytes = (long long) pages * ckpt->pageSize;
+
+    /* Only when the WAL crosses the limit, or the RESTART threshold. */
+    /* Commits above them are handled by the thread's next period.    */
+    if ( limit > 0 && ( ( before < limit && ckpt->walBytes >= limit )
+                || ( before < WAL_RESTART_FACTOR * limit
+                    && ckpt->walBytes >= WAL_RESTART_FACTOR * limit ) ) )
+    {
+        ckpt->wakeup = TRUE;
+        pthread_cond_signal( &ckpt->cond );
+    }
+
+    pthread_mutex_unlock( &ckpt->lock );
+
+    return SQLITE_OK;
+}
+
+/**
+ * Returns up to reclaimPages free pages to the file system from the
+ * checkpointer's connection. Gives up at once if a writer holds the
+ * database, so writers never wait for it.
+ *
+ * @return      The number of pages returned.
+*/
+static int
+CheckpointerReclaim( checkpointer *ckpt )
+{
+    sqlite3_stmt *statement = NULL;
+    char pragma[48];
+    int before = 0, after = 0, rc;
+
+    if ( sqlite3_prepare_v2( ckpt->dbHandle, "PRAGMA freelist_count", -1,
+                            &statement, NULL ) != SQLITE_OK )
+        return 0;
+
+    if ( sqlite3_step( statement ) == SQLITE_ROW )
+        before = sqlite3_column_int( statement, 0 );
+    sqlite3_reset( statement );
+
+    if ( before == 0 )
+    {
+        sqlite3_finalize( statement );
+        return 0;
+    }
+
+    snprintf( pragma, sizeof( pragma ), "PRAGMA incremental_vacuum(%d)",
+            ckpt->config.reclaimPages );
+
+    sqlite3_busy_timeout( ckpt->dbHandle, 0 );
+    rc = sqlite3_exec( ckpt->dbHandle, pragma, NULL, NULL, NULL );
+    sqlite3_busy_timeout( ckpt->dbHandle, ckpt->config.intervalMs );
+
+    if ( rc != SQLITE_OK )
+    {
+        if ( rc != SQLITE_BUSY && rc != SQLITE_LOCKED )
+            logError( ckpt->logFile, "Checkpointer: incremental_vacuum "
+                    "failed: %s", sqlite3_errmsg( ckpt->dbHandle ) );
+
+        sqlite3_finalize( statement );
+        return 0;
+    }
+
+    after = before;
+    if ( sqlite3_step( statement ) == SQLITE_ROW )
+        after = sqlite3_column_int( statement, 0 );
+    sqlite3_finalize( statement );
+
+    return ( before > after ) ? before - after : 0;
+}
+
+static void *
+CheckpointerMain( void *arg )
+{
+    checkpointer *ckpt = arg;
+    struct timespec deadline;
+    struct stat st;
+    long long start, duration;
+    long long walBytes;
+    long commits;
+    int idle = 0, mode, rc, logFrames, ckptFrames, reclaimed;
+
+    pthread_mutex_lock( &ckpt->lock );
+
+    while ( !ckpt->stop )
+    {
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += ckpt->config.intervalMs / 1000;
+        deadline.tv_nsec += ( ckpt->config.intervalMs % 1000 ) * 1000000;
+
+        if ( deadline.tv_nsec >= 1000000000 )
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        while ( !ckpt->stop && !ckpt->wakeup )
+            if ( pthread_cond_timedwait( &ckpt->cond, &ckpt->lock, &deadline )
+                    == ETIMEDOUT )
+                break;
+
+        if ( ckpt->stop )
+            break;
+
+        commits = ckpt->commits;
+        walBytes = ckpt->walBytes;
+        ckpt->commits = 0;
+        ckpt->wakeup = FALSE;
+        pthread_mutex_unlock( &ckpt->lock );
+
+        idle = ( commits == 0 ) ? idle + 1 : 0;
+        mode = SQLITE_CHECKPOINT_PASSIVE;
+
+        if ( ckpt->config.idleTicks > 0 && idle >= ckpt->config.idleTicks )
+        {
+            /* Nothing to do if the WAL was already reset */
+            if ( stat( ckpt->walFile, &st ) == 0 && st.st_size == 0 )
+            {
+                pthread_mutex_lock( &ckpt->lock );
+                ckpt->stats.walSize = 0;
+                continue;
+            }
+
+            mode = SQLITE_CHECKPOINT_TRUNCATE;
+        }
+        else if ( ckpt->config.walSizeLimit > 0
+                && walBytes >= WAL_RESTART_FACTOR * ckpt->config.walSizeLimit )
+        {
+            /* Passive checkpoints can't keep up with the writers and the */
+            /* WAL never restarts: briefly hold writers back until it does */
+            mode = SQLITE_CHECKPOINT_RESTART;
+        }
+
+        /* Only while this connection is idle, it takes the write lock. */
+        /* Before the checkpoint, so it copies the shrunk file.         */
+        reclaimed = ( ckpt->config.reclaimPages > 0 && commits == 0 )
+                    ? CheckpointerReclaim( ckpt ) : 0;
+
+        start = NowUs();
+        rc = sqlite3_wal_checkpoint_v2( ckpt->dbHandle, NULL, mode,
+                                        &logFrames, &ckptFrames );
+        duration = NowUs() - start;
+
+        pthread_mutex_lock( &ckpt->lock );
+
+        ckpt->stats.reclaimedPages += reclaimed;
+        ckpt->stats.walSize = ( stat( ckpt->walFile, &st ) == 0 ) ? st.st_size : 0;
+        ckpt->stats.checkpoints++;
+        ckpt->stats.lastDurationUs = duration;
+        ckpt->stats.totalDurationUs += duration;
+
+        if ( duration > ckpt->stats.maxDurationUs )
+            ckpt->stats.maxDurationUs = duration;
+
+        if ( rc != SQLITE_OK || logFrames < 0 || logFrames != ckptFrames )
+            ckpt->stats.incomplete++;
+        else if ( mode != SQLITE_CHECKPOINT_PASSIVE )
+        {
+            ckpt->walBytes = 0;
+
+            if ( mode == SQLITE_CHECKPOINT_TRUNCATE )
+            {
+                ckpt->stats.truncates++;
+                idle = 0;
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &ckpt->lock );
+
+    return NULL;
+}
+
+DB_ERR
+DBSetSlowQueryLog(databaseADT db, long thresholdMs, FILE *log)
+{
+    slowQuery *query;
+
+    if ( db == NULL || thresholdMs < 0 )
+        return DB_INVALID_ARG;
+
+    if ( thresholdMs > 0 )
+    {
+        db->slowThresholdUs = thresholdMs * 1000LL;
+        db->slowLog = ( log != NULL ) ? log : db->logFile;
+
+        sqlite3_trace_v2( db->dbHandle, SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+                        SlowTrace, db );
+        return DB_SUCCESS;
+    }
+
+    if ( db->slowThresholdUs == 0 )
+        return DB_SUCCESS;
+
+    sqlite3_trace_v2( db->dbHandle, 0, NULL, NULL );
+
+    DBFlushSlowQueryLog( db );
+    db->slowThresholdUs = 0;
+
+    while ( ( query = db->slowQueries ) != NULL )
+    {
+        db->slowQueries = query->next;
+        free( query->key );
+        free( query );
+    }
+
+    memset( db->slowActive, 0, sizeof( db->slowActive ) );
+
+    return DB_SUCCESS;
+}
+
+void
+DBFlushSlowQueryLog(databaseADT db)
+{
+    slowQuery *query;
+
+    if ( db == NULL || db->slowThresholdUs == 0 )
+        return;
+
+    SlowLogPending( db );
+
+    for ( query = db->slowQueries; query != NULL; query = query->next )
+    {
+        if ( query->count == query->reported )
+            continue;
+
+        logError( db->slowLog, "Slow query repeated %ld times (total %ld), "
+                "avg %lld us, max %lld us: %s", query->count - query->reported,
+                query->count, query->totalUs / query->count, query->maxUs,
+                query->key );
+
+        query->reported = query->count;
+    }
+}
+
+static int
+SlowTrace( unsigned type, void *ctx, void *p, void *x )
+{
+    databaseADT db = ctx;
+    sqlite3_stmt *statement = p;
+    slowActive *active, counters = { NULL, 0, 0, 0, 0 };
+    long long durationUs;
+
+    if ( db->inExplain )
+        return 0;
+
+    if ( type == SQLITE_TRACE_ROW )
+    {
+        if ( ( active = SlowActiveFind( db, statement, TRUE ) ) != NULL )
+            active->rows++;
+
+        return 0;
+    }
+
+    /* SQLITE_TRACE_PROFILE, the statement finished running. Inside       */
+    /* StepSql it may be a busy attempt, StepSql records it when it's done */
+    if ( statement == db->slowStepping )
+        return 0;
+
+    if ( ( active = SlowActiveFind( db, statement, FALSE ) ) != NULL )
+    {
+        counters = *active;
+        active->statement = NULL;
+    }
+
+    /* Time since the first StepSql covers its busy retries */
+    if ( counters.startUs != 0 )
+        durationUs = NowUs() - counters.startUs;
+    else
+        durationUs = *(sqlite3_int64 *) x / 1000;
+
+    SlowRecord( db, statement, &counters, durationUs + counters.prepareUs );
+
+    return 0;
+}
+
+static void
+SlowRecord( databaseADT db, sqlite3_stmt *statement,
+            const slowActive *counters, long long durationUs )
+{
+    slowQuery *query;
+    slowPending *pending;
+    char *key, *sql;
+
+    if ( durationUs < db->slowThresholdUs )
+        return;
+
+    if ( ( key = NormalizeSql( sqlite3_sql( statement ) ) ) == NULL )
+        return;
+
+    for ( query = db->slowQueries; query != NULL; query = query->next )
+        if ( strcmp( query->key, key ) == 0 )
+            break;
+
+    if ( query != NULL )
+    {
+        free( key );
+        query->count++;
+        query->totalUs += durationUs;
+
+        if ( durationUs > query->maxUs )
+            query->maxUs = durationUs;
+
+        return;
+    }
+
+    if ( ( query = calloc( 1, sizeof( slowQuery ) ) ) == NULL
+            || ( pending = calloc( 1, sizeof( slowPending ) ) ) == NULL )
+    {
+        free( query );
+        free( key );
+        return;
+    }
+
+    query->key = key;
+    query->count = query->reported = 1;
+    query->totalUs = query->maxUs = durationUs;
+    query->next = db->slowQueries;
+    db->slowQueries = query;
+
+    sql = sqlite3_expanded_sql( statement );
+    pending->sql = strdup( ( sql != NULL ) ? sql : sqlite3_sql( statement ) );
+    sqlite3_free( sql );
+
+    pending->durationUs = durationUs;
+    pending->rows = counters->rows;
+    pending->retries = counters->retries;
+    pending->next = db->slowPending;
+    db->slowPending = pending;
+}
+
+static slowActive *
+SlowActiveFind( databaseADT db, sqlite3_stmt *statement, int create )
+{
+    slowActive *freeSlot = NULL;
+    int i;
+
+    for ( i = 0; i < SLOW_ACTIVE_MAX; i++ )
+    {
+        if ( db->slowActive[i].statement == statement )
+            return &db->slowActive[i];
+
+        if ( db->slowActive[i].statement == NULL && freeSlot == NULL )
+            freeSlot = &db->slowActive[i];
+    }
+
+    if ( !create || freeSlot == NULL )
+        return NULL;
+
+    memset( freeSlot, 0, sizeof( slowActive ) );
+    freeSlot->statement = statement;
+
+    return freeSlot;
+}
+
+static void
+SlowActiveRelease( databaseADT db, sqlite3_stmt *statement )
+{
+    slowActive *active;
+
+    if ( statement != NULL
+            && ( active = SlowActiveFind( db, statement, FALSE ) ) != NULL )
+        active->statement = NULL;
+}
+
 static void
-logError (FILE *errFile, const char *text, ...)
+SlowLogPending( databaseADT db )
 {
-    va_list ap;
+    slowPending *pending;
+    sqlite3_stmt *statement;
+    char *sql;
 
-    if (errFile == NULL || text == NULL)
-        return;
+    db->inExplain = TRUE;
 
-    va_start( ap, text );
+    while ( ( pending = db->slowPending ) != NULL )
+    {
+        db->slowPending = pending->next;
 
-    vfprintf( errFile, text, ap );
-    fprintf( errFile, "\n" );
+        logError( db->slowLog, "Slow query: %lld us, %ld rows, %d busy "
+                "retries: %s", pending->durationUs, pending->rows,
+                pending->retries, pending->sql );
 
-    va_end( ap );
+        if ( pending->sql != NULL
+                && ( sql = sqlite3_mprintf( "EXPLAIN QUERY PLAN %s",
+                                            pending->sql ) ) != NULL )
+        {
+            if ( sqlite3_prepare_v2( db->dbHandle, sql, -1, &statement, NULL )
+                    == SQLITE_OK )
+            {
+                while ( sqlite3_step( statement ) == SQLITE_ROW )
+                    logError( db->slowLog, "    %s",
+                            sqlite3_column_text( statement, 3 ) );
+            }
 
-    return;
+            sqlite3_finalize( statement );
+            sqlite3_free( sql );
+        }
+
+        free( pending->sql );
+        free( pending );
+    }
+
+    db->inExplain = FALSE;
 }
 
-   /******************************************************/
-   /** StepSql:                                         **/
-   /** This encapsulates sqlite step call to handle     **/
-   /** timeout condition.                               **/
-   /******************************************************/
-int StepSql(databaseADT db, sqlite3_stmt *statement);
+static char *
+NormalizeSql( const char *sql )
+{
+    char *out;
+    int i = 0, j = 0;
 
-   /******************************************************/
-   /** PrepareSql:                                      **/
-   /** This encapsulates sqlite prepare call to handle  **/
-   /** timeout condition.                               **/
-   /******************************************************/
-int PrepareSql(databaseADT db, char *SqlStr, int queryLen,
-            sqlite3_stmt **statement, const char **tail);
+    if ( sql == NULL || ( out = malloc( strlen( sql ) + 1 ) ) == NULL )
+        return NULL;
 
-/**
- * Retrieves a sanitized copy of the given string.
- *
- * @param[in]   db      The database to be used.
- * @param[in]   str     The string to be sanitized.
- *
- * @return      Sanitized copy of the string provided.
- *
- * @remarks     The caller is responsible to free the returned string.
-*/
-static char *EscapeString( databaseADT db, const char *str );
+    while ( sql[i] )
+    {
+        if ( sql[i] == '\'' )
+        {
+            /* String literal, '' is an escaped quote */
+            for ( i++; sql[i] && ( sql[i] != '\'' || sql[i+1] == '\'' ); i++ )
+                if ( sql[i] == '\'' )
+                    i++;
 
-/**
- * Executes the given query.
- *
- * @param[in]           db              The database instance.
- * @param[in][out]      statement       The statement structure to be filled
- *                                      when preparing the query.
- * @param[in]           sql             The SQL query to perform. Should have
- *                                      a "%s" in each place an argument should
- *                                      be placed.
- * @param[in]           bindingCount    Number of elements in the binsing array.
- * @param[in]           bindings        Allows to bind blobs. All other types
- *                                      can be isnerted into the query itself.
- * @param[in]           args            Number of arguments to the sql query.
- *
- * @return      An error code if the argument validation failed or the value
- *              returned by SQLite when executing the query.
- *
- * @remarks     All variable arguments passed MUST be char*. They will be
- *              validated against ilegal characters such as \' and \".
-*/
-static int QueryExecute( databaseADT db, sqlite3_stmt **statement,
-                        const char* sql, int bindingCount,
-                        blobBindings* bindings, int args, ... );
+            if ( sql[i] )
+                i++;
 
-static long DBSize(databaseADT db);
+            out[j++] = '?';
+        }
+        else if ( isdigit( (unsigned char) sql[i] )
+                && ( j == 0 || !( isalnum( (unsigned char) out[j-1] )
+                                || out[j-1] == '_' ) ) )
+        {
+            while ( isalnum( (unsigned char) sql[i] ) || sql[i] == '.' )
+                i++;
 
-static long
-DBSize(databaseADT db)
-{
-    long size;
-    struct stat st;
+            out[j++] = '?';
+        }
+        else if ( isspace( (unsigned char) sql[i] ) )
+        {
+            while ( isspace( (unsigned char) sql[i] ) )
+                i++;
 
-    stat(db->dbFile, &st);
-    size = st.st_size;
+            if ( j > 0 && sql[i] )
+                out[j++] = ' ';
+        }
+        else
+            out[j++] = sql[i++];
+    }
 
-    return size;
+    out[j] = '\0';
+
+    return out;
 }
 
-DB_ERR DBBuildDatabase( databaseADT db, const char *schema )
+DB_ERR
+DBaddUserCtl(databaseADT db, const char *user, const char *password,
+        const char *mail, const DBCallCtl *ctl)
 {
-    char sqlStr[1024] = {0};
-    char line[LINE_MAX];
-    FILE *fp = NULL;
-    int ret;
-
-    if ( db == NULL || schema == NULL)
-            return DB_INVALID_ARG;
-
-    if (DBSize(db) > 0)
-        return DB_ALREADY_EXISTS;
+    DB_ERR err;
 
-    if ( (fp = fopen(schema, "r")) == NULL)
+    if ( db == NULL )
         return DB_INVALID_ARG;
 
-    /*Read the schema*/
-    while (fgets(line, LINE_MAX, fp) != NULL)
-    {
-        strcat(sqlStr, line);
+    if ( ( err = BeginCall( db, ctl ) ) != DB_SUCCESS )
+        return err;
 
-        /* execute if ; found*/
-        if ( (strchr(line,';')) != NULL )
-        {
-            ret = sqlite3_exec( db->dbHandle, sqlStr, NULL, NULL, NULL );
+    return EndCall( db, DBaddUser( db, user, password, mail ) );
+}
 
-            if ( ret != SQLITE_OK )
-            {
-                logError( db->logFile, "Error in BuildDatabase - "
-                        "Can't create user table : %s",
-                        sqlite3_errmsg( db->dbHandle ) );
+DB_ERR
+DBgetUserQueueCtl(databaseADT db, queueADT queue, const DBCallCtl *ctl)
+{
+    DB_ERR err;
 
-                return DB_INTERNAL_ERROR;
-            }
-            sqlStr[0] = '\0';
-        }
+    if ( db == NULL )
+        return DB_INVALID_ARG;
 
-    }
-    fclose(fp);
-    return DB_SUCCESS;
+    if ( ( err = BeginCall( db, ctl ) ) != DB_SUCCESS )
+        return err;
+
+    return EndCall( db, DBgetUserQueue( db, queue ) );
 }
 
 DB_ERR
-NewDatabaseADT( databaseADT *db, const char *dbFile, FILE *errLog )
+DBgetUserResultSetCtl(databaseADT db, resultSetADT *result,
+        const DBCallCtl *ctl)
 {
-    int ret;
+    DB_ERR err;
 
-    if ( db == NULL || dbFile == NULL || errLog == NULL )
+    if ( db == NULL )
         return DB_INVALID_ARG;
 
-    if ( ( *db = ( databaseADT ) malloc( sizeof( databaseCDT ) ) ) == NULL)
-        return DB_NO_MEMORY;
+    if ( ( err = BeginCall( db, ctl ) ) != DB_SUCCESS )
+        return err;
 
-    ( *db )->logFile = errLog;
-    ( *db )->dbFile = strdup(dbFile);
+    return EndCall( db, DBgetUserResultSet( db, result ) );
+}
 
-    /* Open the database file */
-    ret = sqlite3_open( dbFile, &( ( *db )->dbHandle ) );
+cancelTokenADT
+NewCancelToken(void)
+{
+    cancelTokenADT token;
 
-    if ( ret )
-    {
-        logError( (*db)->logFile, "Error in NewDatabaseADT - "
-                        "Can't open database : %s",
-                        sqlite3_errmsg( ( *db )->dbHandle ) );
+    if ( ( token = malloc( sizeof( cancelTokenCDT ) ) ) == NULL )
+        return NULL;
 
-        return DB_INTERNAL_ERROR;
-    }
+    atomic_init( &token->cancelled, FALSE );
+    token->handle = NULL;
+    pthread_mutex_init( &token->lock, NULL );
 
-    return DB_SUCCESS;
+    return token;
 }
 
 void
-FreeDatabaseADT( databaseADT db )
+FreeCancelToken(cancelTokenADT token)
 {
-    if ( db == NULL )
+    if ( token == NULL )
         return;
 
-    sqlite3_close(db->dbHandle);
-    free(db->dbFile);
-    free(db);
+    pthread_mutex_destroy( &token->lock );
+    free( token );
 }
 
-DB_ERR
-DBaddUser(databaseADT db, const char *user, const char *password,
-          const char *mail)
+void
+DBCancel(cancelTokenADT token)
 {
-    sqlite3_stmt *statement;
-    int ret;
-    char *userN, *mailN;
-    blobBindings binding;
-    char *sqlSelect = "INSERT INTO users VALUES (NULL, '%s', ? , '%s')";
+    if ( token == NULL )
+        return;
 
-    if (db == NULL || user == NULL || password == NULL || mail == NULL)
-        return DB_INVALID_ARG;
+    pthread_mutex_lock( &token->lock );
 
-    /*TODO: In the next lines inside the if it should free
-            malloced strings in this function */
-    if ( ( userN = EscapeString( db, user ) ) == NULL )
-        return DB_NO_MEMORY;
+    atomic_store( &token->cancelled, TRUE );
 
-    if ( ( mailN = EscapeString( db, mail ) ) == NULL )
-        return DB_NO_MEMORY;
+    /* Stops the running statement right away, even while it waits */
+    if ( token->handle != NULL )
+        sqlite3_interrupt( token->handle );
 
-    binding.param=1;
-    binding.data= (void *)password;
-    binding.size= 128;
+    pthread_mutex_unlock( &token->lock );
+}
+
+void
+ResetCancelToken(cancelTokenADT token)
+{
+    if ( token != NULL )
+        atomic_store( &token->cancelled, FALSE );
+}
 
+static DB_ERR
+BeginCall( databaseADT db, const DBCallCtl *ctl )
+{
+    db->callStatus = DB_SUCCESS;
+    db->deadlineUs = 0;
+    db->cancel = NULL;
 
-    ret = QueryExecute(db, &statement, sqlSelect, 1, &binding, 2, userN, mailN);
+    if ( ctl == NULL || ( ctl->timeoutMs <= 0 && ctl->cancel == NULL ) )
+        return DB_SUCCESS;
 
-    free(userN);
-    free(mailN);
+    if ( ctl->timeoutMs > 0 )
+        db->deadlineUs = NowUs() + ctl->timeoutMs * 1000LL;
 
-    switch (ret)
+    if ( ctl->cancel != NULL )
     {
-        case SQLITE_DONE:
-            sqlite3_finalize( statement );
-            return DB_SUCCESS;
+        /* DBCancel can only interrupt one connection */
+        pthread_mutex_lock( &ctl->cancel->lock );
 
-        case SQLITE_CONSTRAINT:
-            sqlite3_finalize( statement );
-            return DB_ALREADY_EXISTS;
+        if ( ctl->cancel->handle != NULL )
+        {
+            pthread_mutex_unlock( &ctl->cancel->lock );
+            db->deadlineUs = 0;
+            return DB_INVALID_ARG;
+        }
 
-        default:
-            sqlite3_finalize(statement);
-            return DB_INTERNAL_ERROR;
+        ctl->cancel->handle = db->dbHandle;
+        pthread_mutex_unlock( &ctl->cancel->lock );
+
+        db->cancel = ctl->cancel;
+
+        if ( atomic_load( &db->cancel->cancelled ) )
+            return EndCall( db, DB_CANCELLED );
     }
+
+    sqlite3_progress_handler( db->dbHandle, PROGRESS_OPS, ProgressHandler, db );
+
+    return DB_SUCCESS;
 }
 
-DB_ERR
-DBgetUserQueue(databaseADT db, queueADT queue)
+static DB_ERR
+EndCall( databaseADT db, DB_ERR err )
 {
-    sqlite3_stmt *statement;
-    int ret;
-    user_t uq;
-    char *sqlSelect = "SELECT user, password, email FROM users";
+    if ( db->deadlineUs == 0 && db->cancel == NULL )
+        return err;
 
-    if ( db == NULL || queue == NULL )
-        return DB_INVALID_ARG;
-
-    ret = QueryExecute( db, &statement, sqlSelect, 0, NULL, 0 );
+    sqlite3_progress_handler( db->dbHandle, 0, NULL, NULL );
 
-    while ( ret == SQLITE_ROW )
+    if ( db->cancel != NULL )
     {
-        strncpy(uq.name, (char *) sqlite3_column_text(statement, 0),
-                USER_NAME_MAX_LEN);
-        uq.name[USER_NAME_MAX_LEN-1] = 0;
+        pthread_mutex_lock( &db->cancel->lock );
+        db->cancel->handle = NULL;
+        pthread_mutex_unlock( &db->cancel->lock );
+
+        /* Interrupted by DBCancel before the progress handler noticed */
+        if ( err != DB_SUCCESS && db->callStatus == DB_SUCCESS
+                && atomic_load( &db->cancel->cancelled ) )
+            db->callStatus = DB_CANCELLED;
+    }
 
-        strncpy(uq.pass, (char *) sqlite3_column_text(statement, 1),
-                USER_PASS_MAX_LEN);
-        uq.mail[USER_PASS_MAX_LEN-1] = 0;
+    if ( db->callStatus != DB_SUCCESS )
+        err = db->callStatus;
 
-        strncpy(uq.mail, (char *) sqlite3_column_text(statement, 2),
-                USER_MAIL_MAX_LEN);
-        uq.mail[USER_MAIL_MAX_LEN-1] = 0;
+    db->deadlineUs = 0;
+    db->cancel = NULL;
+    db->callStatus = DB_SUCCESS;
 
+    return err;
+}
 
-        if ((enqueue(queue, &uq)) == 1)
-            ret = sqlite3_step( statement );
-        else
-        {
-            sqlite3_finalize( statement );
-            return DB_INTERNAL_ERROR;
-        }
-    }
+static int
+CallExpired( databaseADT db )
+{
+    if ( db->callStatus != DB_SUCCESS )
+        return TRUE;
 
-    sqlite3_finalize( statement );
+    if ( db->cancel != NULL && atomic_load( &db->cancel->cancelled ) )
+        db->callStatus = DB_CANCELLED;
+    else if ( db->deadlineUs != 0 && NowUs() >= db->deadlineUs )
+        db->callStatus = DB_TIMEOUT;
 
-    if ( ret != SQLITE_DONE )
-        return DB_INTERNAL_ERROR;
+    return db->callStatus != DB_SUCCESS;
+}
 
-    return DB_SUCCESS;
+static int
+ProgressHandler( void *ctx )
+{
+    return CallExpired( ( databaseADT ) ctx );
+}
+
+static long long
+NowUs( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 static int
@@ -315,6 +3334,9 @@ QueryExecute( databaseADT db, sqlite3_stmt **statement, const char *sql,
     va_list ap, apCopy;
     int retCode;
 
+    if ( db->slowPending != NULL )
+        SlowLogPending( db );
+
     /* Get the list of arguments */
     va_start( ap, args );
     va_copy( apCopy, ap );
@@ -354,9 +3376,14 @@ QueryExecute( databaseADT db, sqlite3_stmt **statement, const char *sql,
     {
         for ( i = 0; i < bindingCount; i++ )
         {
-            sqlite3_bind_blob( *statement, bindings[i].param,
-                            bindings[i].data, bindings[i].size,
-                                SQLITE_TRANSIENT );
+            if ( bindings[i].data == NULL )
+                sqlite3_bind_zeroblob( *statement, bindings[i].param,
+                                    bindings[i].size );
+            else
+                sqlite3_bind_blob( *statement, bindings[i].param,
+                                bindings[i].data, bindings[i].size,
+                                bindings[i].isStatic ? SQLITE_STATIC
+                                                     : SQLITE_TRANSIENT );
         }
     }
 
@@ -380,6 +3407,11 @@ PrepareSql(databaseADT db, char *SqlStr, int queryLen,
 {
     int rc;
     int n = 0;
+    long long start = 0;
+    slowActive *active;
+
+    if ( db->slowThresholdUs > 0 )
+        start = NowUs();
 
     do
     {
@@ -391,17 +3423,39 @@ PrepareSql(databaseADT db, char *SqlStr, int queryLen,
             n++;
             usleep(SQLTM_TIME);
         }
-    }while((n < SQLTM_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED)));
+    }while((n < SQLTM_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED))
+            && !CallExpired(db));
 
     if( rc != SQLITE_OK)
     {
         logError(db->logFile, "SqlPrepare-Error-H(%d): (%d) %s \n",
                 db->dbHandle, rc, sqlite3_errmsg(db->dbHandle));
+
+        SlowActiveRelease(db, *statement);
+    }
+    else if( db->slowThresholdUs > 0 && *statement != NULL
+            && (active = SlowActiveFind(db, *statement, TRUE)) != NULL )
+    {
+        /* The address may be reused from a statement finalized elsewhere */
+        memset(active, 0, sizeof(slowActive));
+        active->statement = *statement;
+        active->prepareUs = NowUs() - start;
     }
 
     return rc;
 }
 
+int
+FinalizeSql(databaseADT db, sqlite3_stmt *statement)
+{
+    /* Finalizing a running statement reports it through SlowTrace first */
+    int rc = sqlite3_finalize(statement);
+
+    SlowActiveRelease(db, statement);
+
+    return rc;
+}
+
    /******************************************************/
    /** StepSql:                                         **/
    /** This encapsulates sqlite step call to handle     **/
@@ -410,7 +3464,17 @@ PrepareSql(databaseADT db, char *SqlStr, int queryLen,
 int
 StepSql(databaseADT db, sqlite3_stmt *statement)
 {
-    int rc, n = 0;
+    int rc, n = 0, mark = db->stagedCount;
+    slowActive *active = NULL, counters;
+
+    if( db->slowThresholdUs > 0 && statement != NULL
+            && (active = SlowActiveFind(db, statement, TRUE)) != NULL )
+    {
+        if( active->startUs == 0 )
+            active->startUs = NowUs();
+
+        db->slowStepping = statement;
+    }
 
     do
     {
@@ -431,7 +3495,8 @@ StepSql(databaseADT db, sqlite3_stmt *statement)
                 n++;
             }
         }
-    }while((n < SQLTM_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED)));
+    }while((n < SQLTM_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED))
+            && !CallExpired(db));
 
     if( n == SQLTM_COUNT )
     {
@@ -445,12 +3510,30 @@ StepSql(databaseADT db, sqlite3_stmt *statement)
                 db->dbHandle, n);
     }
 
+    /* Busy attempts are part of the statement, not statements on their own */
+    if( active != NULL )
+    {
+        db->slowStepping = NULL;
+        active->retries += n;
+
+        if( rc != SQLITE_ROW )
+        {
+            counters = *active;
+            active->statement = NULL;
+
+            SlowRecord(db, statement, &counters,
+                    NowUs() - counters.startUs + counters.prepareUs);
+        }
+    }
+
     if( rc == SQLITE_MISUSE )
     {
         logError(db->logFile, "sqlite3_step missuse ?? on handle %d\n",
                 db->dbHandle);
     }
 
+    ChangeEndStatement(db, rc, mark);
+
     return rc;
 }
 
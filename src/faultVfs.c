@@ -0,0 +1,614 @@
+/**
+*   @file faultVfs.c
+*   VFS shim that injects latency and faults into another VFS.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../sqlite/sqlite3.h"
+#include "../include/faultVfs.h"
+
+/**
+ * The VFS. base must be the first field, SQLite only knows about it.
+*/
+typedef struct faultVfs
+{
+    sqlite3_vfs base;
+    sqlite3_vfs *real;
+    char *name;
+
+    pthread_mutex_t lock;
+    faultVfsConfig config;
+    faultVfsStats stats;
+} faultVfs;
+
+/**
+ * An open file. The real VFS file is allocated right after it.
+*/
+typedef struct faultFile
+{
+    sqlite3_file base;
+    faultVfs *vfs;
+    sqlite3_file *real;
+} faultFile;
+
+typedef enum { OP_READ, OP_WRITE, OP_SYNC, OP_LOCK, OP_SHM_LOCK } faultOp;
+
+/**
+ * Counts an operation, sleeps for its configured delay and decides
+ * whether it must fail.
+ *
+ * @return      SQLITE_OK if the operation must go on, the error to return
+ *              otherwise. SQLITE_FULL asks a write to store part of its
+ *              data before failing.
+*/
+static int Inject( faultVfs *vfs, faultOp op, int errCode );
+
+/* I/O methods */
+static int FaultClose( sqlite3_file *file );
+static int FaultRead( sqlite3_file *file, void *buf, int amt,
+                    sqlite3_int64 offset );
+static int FaultWrite( sqlite3_file *file, const void *buf, int amt,
+                    sqlite3_int64 offset );
+static int FaultTruncate( sqlite3_file *file, sqlite3_int64 size );
+static int FaultSync( sqlite3_file *file, int flags );
+static int FaultFileSize( sqlite3_file *file, sqlite3_int64 *size );
+static int FaultLock( sqlite3_file *file, int lock );
+static int FaultUnlock( sqlite3_file *file, int lock );
+static int FaultCheckReservedLock( sqlite3_file *file, int *out );
+static int FaultFileControl( sqlite3_file *file, int op, void *arg );
+static int FaultSectorSize( sqlite3_file *file );
+static int FaultDeviceCharacteristics( sqlite3_file *file );
+static int FaultShmMap( sqlite3_file *file, int page, int pageSize,
+                        int extend, void volatile **out );
+static int FaultShmLock( sqlite3_file *file, int offset, int n, int flags );
+static void FaultShmBarrier( sqlite3_file *file );
+static int FaultShmUnmap( sqlite3_file *file, int deleteFlag );
+static int FaultFetch( sqlite3_file *file, sqlite3_int64 offset, int amt,
+                    void **out );
+static int FaultUnfetch( sqlite3_file *file, sqlite3_int64 offset, void *p );
+
+/* VFS methods */
+static int FaultOpen( sqlite3_vfs *vfs, const char *name, sqlite3_file *file,
+                    int flags, int *outFlags );
+static int FaultDelete( sqlite3_vfs *vfs, const char *name, int syncDir );
+static int FaultAccess( sqlite3_vfs *vfs, const char *name, int flags,
+                        int *out );
+static int FaultFullPathname( sqlite3_vfs *vfs, const char *name, int n,
+                            char *out );
+static void *FaultDlOpen( sqlite3_vfs *vfs, const char *name );
+static void FaultDlError( sqlite3_vfs *vfs, int n, char *msg );
+static void ( *FaultDlSym( sqlite3_vfs *vfs, void *handle,
+                        const char *symbol ) )( void );
+static void FaultDlClose( sqlite3_vfs *vfs, void *handle );
+static int FaultRandomness( sqlite3_vfs *vfs, int n, char *out );
+static int FaultSleep( sqlite3_vfs *vfs, int us );
+static int FaultCurrentTime( sqlite3_vfs *vfs, double *out );
+static int FaultGetLastError( sqlite3_vfs *vfs, int n, char *msg );
+static int FaultCurrentTimeInt64( sqlite3_vfs *vfs, sqlite3_int64 *out );
+
+static const sqlite3_io_methods faultIoMethods =
+{
+    3,
+    FaultClose,
+    FaultRead,
+    FaultWrite,
+    FaultTruncate,
+    FaultSync,
+    FaultFileSize,
+    FaultLock,
+    FaultUnlock,
+    FaultCheckReservedLock,
+    FaultFileControl,
+    FaultSectorSize,
+    FaultDeviceCharacteristics,
+    FaultShmMap,
+    FaultShmLock,
+    FaultShmBarrier,
+    FaultShmUnmap,
+    FaultFetch,
+    FaultUnfetch
+};
+
+/**
+ * Returns the fault VFS registered with the given name, NULL if there is
+ * none or it is not a fault VFS.
+*/
+static faultVfs *
+FindFaultVfs( const char *name )
+{
+    sqlite3_vfs *vfs;
+
+    if ( name == NULL || ( vfs = sqlite3_vfs_find( name ) ) == NULL
+            || vfs->xOpen != FaultOpen )
+        return NULL;
+
+    return ( faultVfs * ) vfs;
+}
+
+DB_ERR
+FaultVfsRegister( const char *name, const char *baseName,
+                const faultVfsConfig *config )
+{
+    faultVfs *vfs;
+    sqlite3_vfs *real;
+
+    if ( name == NULL || sqlite3_vfs_find( name ) != NULL )
+        return DB_INVALID_ARG;
+
+    if ( ( real = sqlite3_vfs_find( baseName ) ) == NULL )
+        return DB_NO_MATCH;
+
+    if ( ( vfs = calloc( 1, sizeof( faultVfs ) ) ) == NULL
+            || ( vfs->name = strdup( name ) ) == NULL )
+    {
+        free( vfs );
+        return DB_NO_MEMORY;
+    }
+
+    vfs->real = real;
+
+    if ( config != NULL )
+        vfs->config = *config;
+
+    pthread_mutex_init( &vfs->lock, NULL );
+
+    vfs->base.iVersion = ( real->iVersion < 2 ) ? real->iVersion : 2;
+    vfs->base.szOsFile = sizeof( faultFile ) + real->szOsFile;
+    vfs->base.mxPathname = real->mxPathname;
+    vfs->base.zName = vfs->name;
+    vfs->base.xOpen = FaultOpen;
+    vfs->base.xDelete = FaultDelete;
+    vfs->base.xAccess = FaultAccess;
+    vfs->base.xFullPathname = FaultFullPathname;
+    vfs->base.xDlOpen = FaultDlOpen;
+    vfs->base.xDlError = FaultDlError;
+    vfs->base.xDlSym = FaultDlSym;
+    vfs->base.xDlClose = FaultDlClose;
+    vfs->base.xRandomness = FaultRandomness;
+    vfs->base.xSleep = FaultSleep;
+    vfs->base.xCurrentTime = FaultCurrentTime;
+    vfs->base.xGetLastError = FaultGetLastError;
+    vfs->base.xCurrentTimeInt64 = FaultCurrentTimeInt64;
+
+    if ( sqlite3_vfs_register( &vfs->base, 0 ) != SQLITE_OK )
+    {
+        pthread_mutex_destroy( &vfs->lock );
+        free( vfs->name );
+        free( vfs );
+        return DB_INTERNAL_ERROR;
+    }
+
+    return DB_SUCCESS;
+}
+
+void
+FaultVfsUnregister( const char *name )
+{
+    faultVfs *vfs;
+
+    if ( ( vfs = FindFaultVfs( name ) ) == NULL )
+        return;
+
+    sqlite3_vfs_unregister( &vfs->base );
+    pthread_mutex_destroy( &vfs->lock );
+    free( vfs->name );
+    free( vfs );
+}
+
+DB_ERR
+FaultVfsSetConfig( const char *name, const faultVfsConfig *config )
+{
+    faultVfs *vfs;
+
+    if ( config == NULL )
+        return DB_INVALID_ARG;
+
+    if ( ( vfs = FindFaultVfs( name ) ) == NULL )
+        return DB_NO_MATCH;
+
+    pthread_mutex_lock( &vfs->lock );
+    vfs->config = *config;
+    pthread_mutex_unlock( &vfs->lock );
+
+    return DB_SUCCESS;
+}
+
+DB_ERR
+FaultVfsGetStats( const char *name, faultVfsStats *stats, int reset )
+{
+    faultVfs *vfs;
+
+    if ( stats == NULL )
+        return DB_INVALID_ARG;
+
+    if ( ( vfs = FindFaultVfs( name ) ) == NULL )
+        return DB_NO_MATCH;
+
+    pthread_mutex_lock( &vfs->lock );
+
+    *stats = vfs->stats;
+
+    if ( reset )
+        memset( &vfs->stats, 0, sizeof( faultVfsStats ) );
+
+    pthread_mutex_unlock( &vfs->lock );
+
+    return DB_SUCCESS;
+}
+
+static int
+Inject( faultVfs *vfs, faultOp op, int errCode )
+{
+    long long count = 0;
+    long delay = 0;
+    int every = 0, other = 0, otherCode = errCode, fail;
+
+    pthread_mutex_lock( &vfs->lock );
+
+    switch ( op )
+    {
+        case OP_READ:
+            count = ++vfs->stats.reads;
+            delay = vfs->config.readDelayUs;
+            every = vfs->config.ioErrorEvery;
+            break;
+
+        case OP_WRITE:
+            count = ++vfs->stats.writes;
+            delay = vfs->config.writeDelayUs;
+            every = vfs->config.ioErrorEvery;
+            other = vfs->config.shortWriteEvery;
+            otherCode = SQLITE_FULL;
+            break;
+
+        case OP_SYNC:
+            count = ++vfs->stats.syncs;
+            delay = vfs->config.syncDelayUs;
+            every = vfs->config.ioErrorEvery;
+            other = vfs->config.syncErrorEvery;
+            break;
+
+        case OP_LOCK:
+            count = ++vfs->stats.locks;
+            delay = vfs->config.lockDelayUs;
+            every = vfs->config.busyEvery;
+            break;
+
+        case OP_SHM_LOCK:
+            delay = vfs->config.lockDelayUs;
+            break;
+    }
+
+    fail = ( every > 0 && count % every == 0 );
+
+    if ( !fail && other > 0 && count % other == 0 )
+    {
+        fail = TRUE;
+        errCode = otherCode;
+    }
+
+    if ( fail && errCode == SQLITE_BUSY )
+        vfs->stats.busy++;
+    else if ( fail )
+        vfs->stats.ioErrors++;
+
+    pthread_mutex_unlock( &vfs->lock );
+
+    if ( delay > 0 )
+        usleep( delay );
+
+    return fail ? errCode : SQLITE_OK;
+}
+
+/* I/O methods */
+
+static int
+FaultClose( sqlite3_file *file )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xClose( f->real );
+}
+
+static int
+FaultRead( sqlite3_file *file, void *buf, int amt, sqlite3_int64 offset )
+{
+    faultFile *f = ( faultFile * ) file;
+    int rc;
+
+    if ( ( rc = Inject( f->vfs, OP_READ, SQLITE_IOERR_READ ) ) != SQLITE_OK )
+        return rc;
+
+    return f->real->pMethods->xRead( f->real, buf, amt, offset );
+}
+
+static int
+FaultWrite( sqlite3_file *file, const void *buf, int amt,
+            sqlite3_int64 offset )
+{
+    faultFile *f = ( faultFile * ) file;
+    int rc;
+
+    if ( ( rc = Inject( f->vfs, OP_WRITE, SQLITE_IOERR_WRITE ) ) == SQLITE_FULL )
+    {
+        /* Short write, as the unix VFS reports a full disk */
+        f->real->pMethods->xWrite( f->real, buf, amt / 2, offset );
+        return rc;
+    }
+
+    if ( rc != SQLITE_OK )
+        return rc;
+
+    return f->real->pMethods->xWrite( f->real, buf, amt, offset );
+}
+
+static int
+FaultTruncate( sqlite3_file *file, sqlite3_int64 size )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xTruncate( f->real, size );
+}
+
+static int
+FaultSync( sqlite3_file *file, int flags )
+{
+    faultFile *f = ( faultFile * ) file;
+    int rc;
+
+    if ( ( rc = Inject( f->vfs, OP_SYNC, SQLITE_IOERR_FSYNC ) ) != SQLITE_OK )
+        return rc;
+
+    return f->real->pMethods->xSync( f->real, flags );
+}
+
+static int
+FaultFileSize( sqlite3_file *file, sqlite3_int64 *size )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xFileSize( f->real, size );
+}
+
+static int
+FaultLock( sqlite3_file *file, int lock )
+{
+    faultFile *f = ( faultFile * ) file;
+    int rc;
+
+    if ( ( rc = Inject( f->vfs, OP_LOCK, SQLITE_BUSY ) ) != SQLITE_OK )
+        return rc;
+
+    return f->real->pMethods->xLock( f->real, lock );
+}
+
+static int
+FaultUnlock( sqlite3_file *file, int lock )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xUnlock( f->real, lock );
+}
+
+static int
+FaultCheckReservedLock( sqlite3_file *file, int *out )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xCheckReservedLock( f->real, out );
+}
+
+static int
+FaultFileControl( sqlite3_file *file, int op, void *arg )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xFileControl( f->real, op, arg );
+}
+
+static int
+FaultSectorSize( sqlite3_file *file )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xSectorSize( f->real );
+}
+
+static int
+FaultDeviceCharacteristics( sqlite3_file *file )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    return f->real->pMethods->xDeviceCharacteristics( f->real );
+}
+
+static int
+FaultShmMap( sqlite3_file *file, int page, int pageSize, int extend,
+            void volatile **out )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    if ( f->real->pMethods->iVersion < 2 )
+        return SQLITE_IOERR;
+
+    return f->real->pMethods->xShmMap( f->real, page, pageSize, extend, out );
+}
+
+static int
+FaultShmLock( sqlite3_file *file, int offset, int n, int flags )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    if ( f->real->pMethods->iVersion < 2 )
+        return SQLITE_IOERR;
+
+    if ( flags & SQLITE_SHM_LOCK )
+        Inject( f->vfs, OP_SHM_LOCK, SQLITE_OK );
+
+    return f->real->pMethods->xShmLock( f->real, offset, n, flags );
+}
+
+static void
+FaultShmBarrier( sqlite3_file *file )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    if ( f->real->pMethods->iVersion >= 2 )
+        f->real->pMethods->xShmBarrier( f->real );
+}
+
+static int
+FaultShmUnmap( sqlite3_file *file, int deleteFlag )
+{
+    faultFile *f = ( faultFile * ) file;
+
+    if ( f->real->pMethods->iVersion < 2 )
+        return SQLITE_OK;
+
+    return f->real->pMethods->xShmUnmap( f->real, deleteFlag );
+}
+
+static int
+FaultFetch( sqlite3_file *file, sqlite3_int64 offset, int amt, void **out )
+{
+    /* Not mapping pages keeps every read going through FaultRead */
+    *out = NULL;
+
+    return SQLITE_OK;
+}
+
+static int
+FaultUnfetch( sqlite3_file *file, sqlite3_int64 offset, void *p )
+{
+    return SQLITE_OK;
+}
+
+/* VFS methods */
+
+static int
+FaultOpen( sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags,
+        int *outFlags )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+    faultFile *f = ( faultFile * ) file;
+    int rc;
+
+    f->vfs = v;
+    f->real = ( sqlite3_file * ) &f[1];
+
+    rc = v->real->xOpen( v->real, name, f->real, flags, outFlags );
+
+    /* SQLite only calls xClose if pMethods is set */
+    f->base.pMethods = ( f->real->pMethods != NULL ) ? &faultIoMethods : NULL;
+
+    return rc;
+}
+
+static int
+FaultDelete( sqlite3_vfs *vfs, const char *name, int syncDir )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xDelete( v->real, name, syncDir );
+}
+
+static int
+FaultAccess( sqlite3_vfs *vfs, const char *name, int flags, int *out )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xAccess( v->real, name, flags, out );
+}
+
+static int
+FaultFullPathname( sqlite3_vfs *vfs, const char *name, int n, char *out )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xFullPathname( v->real, name, n, out );
+}
+
+static void *
+FaultDlOpen( sqlite3_vfs *vfs, const char *name )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xDlOpen( v->real, name );
+}
+
+static void
+FaultDlError( sqlite3_vfs *vfs, int n, char *msg )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    v->real->xDlError( v->real, n, msg );
+}
+
+static void
+( *FaultDlSym( sqlite3_vfs *vfs, void *handle, const char *symbol ) )( void )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xDlSym( v->real, handle, symbol );
+}
+
+static void
+FaultDlClose( sqlite3_vfs *vfs, void *handle )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    v->real->xDlClose( v->real, handle );
+}
+
+static int
+FaultRandomness( sqlite3_vfs *vfs, int n, char *out )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xRandomness( v->real, n, out );
+}
+
+static int
+FaultSleep( sqlite3_vfs *vfs, int us )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xSleep( v->real, us );
+}
+
+static int
+FaultCurrentTime( sqlite3_vfs *vfs, double *out )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xCurrentTime( v->real, out );
+}
+
+static int
+FaultGetLastError( sqlite3_vfs *vfs, int n, char *msg )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    return v->real->xGetLastError( v->real, n, msg );
+}
+
+static int
+FaultCurrentTimeInt64( sqlite3_vfs *vfs, sqlite3_int64 *out )
+{
+    faultVfs *v = ( faultVfs * ) vfs;
+
+    if ( v->real->iVersion < 2 || v->real->xCurrentTimeInt64 == NULL )
+    {
+        double now;
+        int rc = v->real->xCurrentTime( v->real, &now );
+
+        *out = ( sqlite3_int64 ) ( now * 86400000.0 );
+        return rc;
+    }
+
+    return v->real->xCurrentTimeInt64( v->real, out );
+}
@@ -0,0 +1,281 @@
+/**
+*   @file resultSetADT.c
+*   Arena backed result sets.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "../include/resultSetADT.h"
+
+/* Initial sizes, both grow by doubling */
+#define RS_INITIAL_ARENA    4096
+#define RS_INITIAL_ROWS     64
+
+/* Length prefix used to store an SQL NULL */
+#define RS_NULL_FIELD       UINT32_MAX
+
+/**
+ * Every field is stored as a uint32_t length, the field bytes and a '\0'.
+ * rows[i] is the offset in the arena of the first field of row i.
+*/
+typedef struct resultSetCDT
+{
+    int columns;
+    unsigned char *arena;
+    size_t used;
+    size_t size;
+    size_t *rows;
+    int rowCount;
+    int rowSize;
+} resultSetCDT;
+
+/**
+ * Makes sure the arena can hold need more bytes.
+ *
+ * @return      1 if the arena is big enough, 0 if there is not enough memory.
+*/
+static int ReserveArena( resultSetADT rs, size_t need );
+
+/**
+ * Makes sure there is room for one more row offset.
+ *
+ * @return      1 if there is room, 0 if there is not enough memory.
+*/
+static int ReserveRows( resultSetADT rs );
+
+static int
+ReserveArena( resultSetADT rs, size_t need )
+{
+    unsigned char *aux;
+    size_t size = rs->size;
+
+    if ( rs->used + need <= rs->size )
+        return 1;
+
+    while ( rs->used + need > size )
+        size *= 2;
+
+    if ( ( aux = realloc( rs->arena, size ) ) == NULL )
+        return 0;
+
+    rs->arena = aux;
+    rs->size = size;
+
+    return 1;
+}
+
+static int
+ReserveRows( resultSetADT rs )
+{
+    size_t *aux;
+
+    if ( rs->rowCount < rs->rowSize )
+        return 1;
+
+    if ( ( aux = realloc( rs->rows, 2 * rs->rowSize * sizeof( size_t ) ) )
+            == NULL )
+        return 0;
+
+    rs->rows = aux;
+    rs->rowSize *= 2;
+
+    return 1;
+}
+
+resultSetADT
+NewResultSet( int columns )
+{
+    resultSetADT rs;
+
+    if ( columns <= 0 )
+        return NULL;
+
+    if ( ( rs = malloc( sizeof( resultSetCDT ) ) ) == NULL )
+        return NULL;
+
+    rs->arena = malloc( RS_INITIAL_ARENA );
+    rs->rows = malloc( RS_INITIAL_ROWS * sizeof( size_t ) );
+
+    if ( rs->arena == NULL || rs->rows == NULL )
+    {
+        free( rs->arena );
+        free( rs->rows );
+        free( rs );
+        return NULL;
+    }
+
+    rs->columns = columns;
+    rs->used = 0;
+    rs->size = RS_INITIAL_ARENA;
+    rs->rowCount = 0;
+    rs->rowSize = RS_INITIAL_ROWS;
+
+    return rs;
+}
+
+void
+FreeResultSet( resultSetADT rs )
+{
+    if ( rs == NULL )
+        return;
+
+    free( rs->arena );
+    free( rs->rows );
+    free( rs );
+}
+
+resultSetADT
+RSClone( resultSetADT rs )
+{
+    resultSetADT copy;
+
+    if ( rs == NULL )
+        return NULL;
+
+    if ( ( copy = malloc( sizeof( resultSetCDT ) ) ) == NULL )
+        return NULL;
+
+    /* The copy is sized to fit, it only grows if rows are appended */
+    copy->size = ( rs->used > 0 ) ? rs->used : 1;
+    copy->rowSize = ( rs->rowCount > 0 ) ? rs->rowCount : 1;
+    copy->arena = malloc( copy->size );
+    copy->rows = malloc( copy->rowSize * sizeof( size_t ) );
+
+    if ( copy->arena == NULL || copy->rows == NULL )
+    {
+        FreeResultSet( copy );
+        return NULL;
+    }
+
+    memcpy( copy->arena, rs->arena, rs->used );
+    memcpy( copy->rows, rs->rows, rs->rowCount * sizeof( size_t ) );
+    copy->columns = rs->columns;
+    copy->used = rs->used;
+    copy->rowCount = rs->rowCount;
+
+    return copy;
+}
+
+size_t
+RSMemoryUsage( resultSetADT rs )
+{
+    if ( rs == NULL )
+        return 0;
+
+    return sizeof( resultSetCDT ) + rs->size + rs->rowSize * sizeof( size_t );
+}
+
+int
+RSAppendRow( resultSetADT rs, const void * const *fields, const int *lengths )
+{
+    size_t need = 0;
+    uint32_t len;
+    int i;
+
+    if ( rs == NULL || fields == NULL || lengths == NULL )
+        return 0;
+
+    for ( i = 0; i < rs->columns; i++ )
+    {
+        need += sizeof( uint32_t );
+
+        if ( fields[i] != NULL )
+            need += lengths[i] + 1;
+    }
+
+    if ( !ReserveArena( rs, need ) || !ReserveRows( rs ) )
+        return 0;
+
+    rs->rows[rs->rowCount++] = rs->used;
+
+    for ( i = 0; i < rs->columns; i++ )
+    {
+        len = ( fields[i] == NULL ) ? RS_NULL_FIELD : (uint32_t) lengths[i];
+
+        memcpy( rs->arena + rs->used, &len, sizeof( uint32_t ) );
+        rs->used += sizeof( uint32_t );
+
+        if ( fields[i] == NULL )
+            continue;
+
+        memcpy( rs->arena + rs->used, fields[i], len );
+        rs->used += len;
+        rs->arena[rs->used++] = '\0';
+    }
+
+    return 1;
+}
+
+int
+RSRowCount( resultSetADT rs )
+{
+    return ( rs == NULL ) ? 0 : rs->rowCount;
+}
+
+int
+RSColumnCount( resultSetADT rs )
+{
+    return ( rs == NULL ) ? 0 : rs->columns;
+}
+
+const void *
+RSGetField( resultSetADT rs, int row, int col, int *length )
+{
+    size_t offset;
+    uint32_t len;
+    int i;
+
+    if ( rs == NULL || row < 0 || row >= rs->rowCount
+            || col < 0 || col >= rs->columns )
+        return NULL;
+
+    offset = rs->rows[row];
+
+    /* Skip the previous fields of the row */
+    for ( i = 0; ; i++ )
+    {
+        memcpy( &len, rs->arena + offset, sizeof( uint32_t ) );
+        offset += sizeof( uint32_t );
+
+        if ( i == col )
+            break;
+
+        if ( len != RS_NULL_FIELD )
+            offset += len + 1;
+    }
+
+    if ( length != NULL )
+        *length = ( len == RS_NULL_FIELD ) ? 0 : (int) len;
+
+    return ( len == RS_NULL_FIELD ) ? NULL : rs->arena + offset;
+}
+
+const char *
+RSGetText( resultSetADT rs, int row, int col )
+{
+    return (const char *) RSGetField( rs, row, col, NULL );
+}
+
+int
+RSGetInt64( resultSetADT rs, int row, int col, long long *value )
+{
+    const char *text = RSGetText( rs, row, col );
+    char *end;
+    long long n;
+
+    if ( text == NULL || *text == '\0' )
+        return 0;
+
+    errno = 0;
+    n = strtoll( text, &end, 10 );
+
+    if ( *end != '\0' || errno == ERANGE )
+        return 0;
+
+    *value = n;
+
+    return 1;
+}
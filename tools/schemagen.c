@@ -0,0 +1,679 @@
+/**
+*   @file schemagen.c
+*   Generates typed row accessors from a schema file.
+*
+*   Usage: schemagen schema.sql outName [sqliteHeader [adtHeader]]
+*
+*   sqliteHeader and adtHeader are the paths outName.h includes sqlite3.h
+*   and databaseADT.h with, as they would be written in an #include. They
+*   default to sqlite3.h and databaseADT.h, found through the -I paths.
+*
+*   Reads every CREATE TABLE statement in the schema and writes outName.h
+*   and outName.c with, for every table:
+*    - A struct with one field per column.
+*    - Column index constants.
+*    - Static SQL strings, prepared through DBPrepareCached.
+*    - Insert, get by rowid and iterate functions that bind and read the
+*      columns directly.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define MAX_TOKEN       128
+#define MAX_COLUMNS     64
+#define MAX_TABLES      64
+
+typedef enum { COL_INTEGER, COL_REAL, COL_TEXT, COL_BLOB } colKind;
+
+typedef struct column_t
+{
+    char name[MAX_TOKEN];
+    colKind kind;
+    int size;           /* Declared size of text columns, 0 if none */
+    int isRowid;        /* INTEGER PRIMARY KEY */
+} column_t;
+
+typedef struct table_t
+{
+    char name[MAX_TOKEN];
+    column_t columns[MAX_COLUMNS];
+    int columnCount;
+} table_t;
+
+/* Tokenizer state */
+static const char *src;
+static char token[MAX_TOKEN];
+
+/**
+ * Reads the next token of the schema into token.
+ *
+ * @return      1 if a token was read, 0 at the end of the input.
+*/
+static int nextToken( void );
+
+/**
+ * Parses a CREATE TABLE statement, the CREATE TABLE tokens already read.
+ *
+ * @return      1 if the table was parsed, 0 on syntax errors.
+*/
+static int parseTable( table_t *table );
+
+static void writeHeader( FILE *out, const char *name, const char *sqliteHeader,
+                        const char *adtHeader, table_t *tables, int n );
+static void writeSource( FILE *out, const char *name, table_t *tables, int n );
+
+static int
+isWord( const char *word )
+{
+    return strcasecmp( token, word ) == 0;
+}
+
+static int
+nextToken( void )
+{
+    int len = 0;
+    char quote;
+
+    for ( ;; )
+    {
+        while ( isspace( (unsigned char) *src ) )
+            src++;
+
+        if ( src[0] == '-' && src[1] == '-' )
+        {
+            while ( *src && *src != '\n' )
+                src++;
+        }
+        else if ( src[0] == '/' && src[1] == '*' )
+        {
+            if ( ( src = strstr( src + 2, "*/" ) ) == NULL )
+                src = "";
+            else
+                src += 2;
+        }
+        else
+            break;
+    }
+
+    if ( *src == '\0' )
+        return 0;
+
+    if ( *src == '"' || *src == '`' || *src == '[' || *src == '\'' )
+    {
+        /* Quoted identifier or string, quotes are dropped */
+        quote = ( *src == '[' ) ? ']' : *src;
+        src++;
+
+        while ( *src && *src != quote )
+        {
+            if ( len < MAX_TOKEN - 1 )
+                token[len++] = *src;
+            src++;
+        }
+
+        if ( *src )
+            src++;
+    }
+    else if ( isalnum( (unsigned char) *src ) || *src == '_' )
+    {
+        while ( isalnum( (unsigned char) *src ) || *src == '_' )
+        {
+            if ( len < MAX_TOKEN - 1 )
+                token[len++] = *src;
+            src++;
+        }
+    }
+    else
+        token[len++] = *src++;
+
+    token[len] = '\0';
+
+    return 1;
+}
+
+/**
+ * Skips tokens up to the end of the current column definition, that is,
+ * the next ',' or ')' outside parenthesis. The delimiter is left in token.
+*/
+static void
+skipDefinition( void )
+{
+    int depth = 0;
+
+    while ( nextToken() )
+    {
+        if ( token[0] == '(' )
+            depth++;
+        else if ( token[0] == ')' && depth-- == 0 )
+            return;
+        else if ( token[0] == ',' && depth == 0 )
+            return;
+    }
+}
+
+static colKind
+typeAffinity( const char *type )
+{
+    char upper[MAX_TOKEN * 4];
+    int i;
+
+    for ( i = 0; type[i] && i < (int) sizeof( upper ) - 1; i++ )
+        upper[i] = toupper( (unsigned char) type[i] );
+    upper[i] = '\0';
+
+    /* Same rules SQLite uses to determine column affinity */
+    if ( strstr( upper, "INT" ) )
+        return COL_INTEGER;
+    if ( strstr( upper, "CHAR" ) || strstr( upper, "CLOB" )
+            || strstr( upper, "TEXT" ) )
+        return COL_TEXT;
+    if ( strstr( upper, "BLOB" ) || upper[0] == '\0' )
+        return COL_BLOB;
+
+    return COL_REAL;
+}
+
+static int
+parseTable( table_t *table )
+{
+    column_t *col;
+    char type[MAX_TOKEN * 4];
+    int primary;
+
+    table->columnCount = 0;
+
+    if ( !nextToken() )
+        return 0;
+
+    if ( isWord( "IF" ) )
+    {
+        /* IF NOT EXISTS */
+        nextToken();
+        nextToken();
+        nextToken();
+    }
+
+    strcpy( table->name, token );
+
+    if ( !nextToken() || token[0] != '(' )
+        return 0;
+
+    while ( nextToken() )
+    {
+        if ( isWord( "PRIMARY" ) || isWord( "UNIQUE" ) || isWord( "CHECK" )
+                || isWord( "FOREIGN" ) || isWord( "CONSTRAINT" ) )
+        {
+            /* Table constraint */
+            skipDefinition();
+        }
+        else
+        {
+            if ( table->columnCount == MAX_COLUMNS )
+                return 0;
+
+            col = &table->columns[table->columnCount++];
+            strcpy( col->name, token );
+            col->size = 0;
+            col->isRowid = 0;
+            type[0] = '\0';
+            primary = 0;
+
+            /* The type name ends at the first constraint or delimiter */
+            while ( nextToken() && token[0] != ',' && token[0] != ')' )
+            {
+                if ( token[0] == '(' )
+                {
+                    nextToken();
+                    col->size = atoi( token );
+
+                    while ( nextToken() && token[0] != ')' )
+                        ;
+                    continue;
+                }
+
+                if ( isWord( "PRIMARY" ) || isWord( "NOT" ) || isWord( "NULL" )
+                        || isWord( "UNIQUE" ) || isWord( "DEFAULT" )
+                        || isWord( "CHECK" ) || isWord( "REFERENCES" )
+                        || isWord( "COLLATE" ) || isWord( "CONSTRAINT" )
+                        || isWord( "GENERATED" ) || isWord( "AS" ) )
+                {
+                    primary = isWord( "PRIMARY" );
+                    skipDefinition();
+                    break;
+                }
+
+                if ( strlen( type ) + strlen( token ) + 2 < sizeof( type ) )
+                {
+                    strcat( type, " " );
+                    strcat( type, token );
+                }
+            }
+
+            col->kind = typeAffinity( type );
+
+            /* Only INTEGER PRIMARY KEY columns are an alias for the rowid */
+            col->isRowid = primary && strcasecmp( type, " INTEGER" ) == 0;
+        }
+
+        if ( token[0] == ')' )
+            break;
+    }
+
+    while ( nextToken() && token[0] != ';' )
+        ;
+
+    return table->columnCount > 0;
+}
+
+/**
+ * Writes name with its first letter in uppercase.
+*/
+static void
+writeCapitalized( FILE *out, const char *name )
+{
+    fprintf( out, "%c%s", toupper( (unsigned char) name[0] ), name + 1 );
+}
+
+/**
+ * Writes name in uppercase.
+*/
+static void
+writeUpper( FILE *out, const char *name )
+{
+    for ( ; *name; name++ )
+        fputc( toupper( (unsigned char) *name ), out );
+}
+
+static void
+writeHeader( FILE *out, const char *name, const char *sqliteHeader,
+            const char *adtHeader, table_t *tables, int n )
+{
+    table_t *t;
+    column_t *c;
+    int i, j;
+
+    fprintf( out, "/* Generated by schemagen, do not edit. */\n\n" );
+    fprintf( out, "#ifndef __" );
+    writeUpper( out, name );
+    fprintf( out, "_H__\n#define __" );
+    writeUpper( out, name );
+    fprintf( out, "_H__\n\n" );
+    fprintf( out, "#include <stdio.h>\n\n" );
+    fprintf( out, "#include \"%s\"\n", sqliteHeader );
+    fprintf( out, "#include \"%s\"\n", adtHeader );
+
+    for ( i = 0; i < n; i++ )
+    {
+        t = &tables[i];
+
+        fprintf( out, "\n/* Table %s */\n\n", t->name );
+        fprintf( out, "#define " );
+        writeUpper( out, t->name );
+        fprintf( out, "_COLUMNS %d\n", t->columnCount );
+
+        for ( j = 0; j < t->columnCount; j++ )
+        {
+            fprintf( out, "#define " );
+            writeUpper( out, t->name );
+            fprintf( out, "_COL_" );
+            writeUpper( out, t->columns[j].name );
+            fprintf( out, " %d\n", j );
+        }
+
+        fprintf( out, "\n/**\n * Row of %s. Text columns without a declared "
+                "size and blobs point\n * to memory owned by the caller on "
+                "insert, and by SQLite during a\n * callback.\n*/\n",
+                t->name );
+        fprintf( out, "typedef struct %s_t\n{\n", t->name );
+
+        for ( j = 0; j < t->columnCount; j++ )
+        {
+            c = &t->columns[j];
+
+            switch ( c->kind )
+            {
+                case COL_INTEGER:
+                    fprintf( out, "    sqlite3_int64 %s;\n", c->name );
+                    break;
+
+                case COL_REAL:
+                    fprintf( out, "    double %s;\n", c->name );
+                    break;
+
+                case COL_TEXT:
+                    if ( c->size > 0 )
+                        fprintf( out, "    char %s[%d];\n", c->name,
+                                c->size + 1 );
+                    else
+                        fprintf( out, "    const char *%s;\n", c->name );
+                    break;
+
+                case COL_BLOB:
+                    fprintf( out, "    const void *%s;\n", c->name );
+                    fprintf( out, "    int %sLen;\n", c->name );
+                    break;
+            }
+        }
+
+        fprintf( out, "} %s_t;\n\n", t->name );
+
+        fprintf( out, "/**\n * Callback for rows of %s. Returning non zero "
+                "stops the iteration.\n*/\n", t->name );
+        fprintf( out, "typedef int (*%sCallbackT)( const %s_t *row, "
+                "void *ctx );\n\n", t->name, t->name );
+
+        fprintf( out, "/**\n * Inserts a row in %s. INTEGER PRIMARY KEY "
+                "columns are assigned by\n * SQLite, the new rowid is "
+                "stored in rowid if it is not NULL.\n*/\n", t->name );
+        fprintf( out, "DB_ERR DBinsert" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( databaseADT db, const %s_t *row, "
+                "sqlite3_int64 *rowid );\n\n", t->name );
+
+        fprintf( out, "/**\n * Calls fn with the row of %s with the given "
+                "rowid.\n * Returns DB_NO_MATCH if there is no such row.\n"
+                "*/\n", t->name );
+        fprintf( out, "DB_ERR DBget" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( databaseADT db, sqlite3_int64 rowid, "
+                "%sCallbackT fn,\n        void *ctx );\n\n", t->name );
+
+        fprintf( out, "/**\n * Calls fn with every row of %s.\n*/\n",
+                t->name );
+        fprintf( out, "DB_ERR DBforEach" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( databaseADT db, %sCallbackT fn, void *ctx );\n",
+                t->name );
+    }
+
+    fprintf( out, "\n#endif\n" );
+}
+
+static void
+writeSource( FILE *out, const char *name, table_t *tables, int n )
+{
+    table_t *t;
+    column_t *c;
+    int i, j, first, param;
+
+    fprintf( out, "/* Generated by schemagen, do not edit. */\n\n" );
+    fprintf( out, "#include <string.h>\n\n" );
+    fprintf( out, "#include \"%s.h\"\n", name );
+
+    for ( i = 0; i < n; i++ )
+    {
+        t = &tables[i];
+
+        /* SQL */
+        fprintf( out, "\nstatic const char %sInsertSql[] =\n"
+                "    \"INSERT INTO %s (", t->name, t->name );
+        for ( j = 0, first = 1; j < t->columnCount; j++ )
+            if ( !t->columns[j].isRowid )
+            {
+                fprintf( out, "%s%s", first ? "" : ", ", t->columns[j].name );
+                first = 0;
+            }
+        fprintf( out, ") VALUES (" );
+        for ( j = 0, first = 1; j < t->columnCount; j++ )
+            if ( !t->columns[j].isRowid )
+            {
+                fprintf( out, "%s?", first ? "" : ", " );
+                first = 0;
+            }
+        fprintf( out, ")\";\n\n" );
+
+        fprintf( out, "static const char %sSelectSql[] =\n    \"SELECT ",
+                t->name );
+        for ( j = 0; j < t->columnCount; j++ )
+            fprintf( out, "%s%s", j ? ", " : "", t->columns[j].name );
+        fprintf( out, " FROM %s\";\n\n", t->name );
+
+        fprintf( out, "static const char %sGetSql[] =\n    \"SELECT ",
+                t->name );
+        for ( j = 0; j < t->columnCount; j++ )
+            fprintf( out, "%s%s", j ? ", " : "", t->columns[j].name );
+        fprintf( out, " FROM %s WHERE rowid = ?\";\n", t->name );
+
+        /* Row reader */
+        fprintf( out, "\nstatic void\nread" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( sqlite3_stmt *statement, %s_t *row )\n{\n",
+                t->name );
+        for ( j = 0; j < t->columnCount; j++ )
+        {
+            c = &t->columns[j];
+
+            switch ( c->kind )
+            {
+                case COL_INTEGER:
+                    fprintf( out, "    row->%s = sqlite3_column_int64( "
+                            "statement, %d );\n", c->name, j );
+                    break;
+
+                case COL_REAL:
+                    fprintf( out, "    row->%s = sqlite3_column_double( "
+                            "statement, %d );\n", c->name, j );
+                    break;
+
+                case COL_TEXT:
+                    if ( c->size > 0 )
+                    {
+                        fprintf( out, "    if ( sqlite3_column_type( "
+                                "statement, %d ) == SQLITE_NULL )\n"
+                                "        row->%s[0] = '\\0';\n    else\n"
+                                "    {\n        strncpy( row->%s, "
+                                "(const char *) sqlite3_column_text( "
+                                "statement, %d ),\n"
+                                "                sizeof( row->%s ) - 1 );\n"
+                                "        row->%s[sizeof( row->%s ) - 1] = "
+                                "'\\0';\n    }\n", j, c->name, c->name, j,
+                                c->name, c->name, c->name );
+                    }
+                    else
+                        fprintf( out, "    row->%s = (const char *) "
+                                "sqlite3_column_text( statement, %d );\n",
+                                c->name, j );
+                    break;
+
+                case COL_BLOB:
+                    fprintf( out, "    row->%s = sqlite3_column_blob( "
+                            "statement, %d );\n", c->name, j );
+                    fprintf( out, "    row->%sLen = sqlite3_column_bytes( "
+                            "statement, %d );\n", c->name, j );
+                    break;
+            }
+        }
+        fprintf( out, "}\n" );
+
+        /* Insert */
+        fprintf( out, "\nDB_ERR\nDBinsert" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( databaseADT db, const %s_t *row, "
+                "sqlite3_int64 *rowid )\n{\n"
+                "    sqlite3_stmt *statement;\n    DB_ERR err;\n    int rc;\n\n"
+                "    if ( row == NULL )\n        return DB_INVALID_ARG;\n\n"
+                "    if ( ( err = DBPrepareCached( db, %sInsertSql, "
+                "&statement ) ) != DB_SUCCESS )\n        return err;\n\n",
+                t->name, t->name );
+
+        for ( j = 0, param = 1; j < t->columnCount; j++ )
+        {
+            c = &t->columns[j];
+
+            if ( c->isRowid )
+                continue;
+
+            switch ( c->kind )
+            {
+                case COL_INTEGER:
+                    fprintf( out, "    sqlite3_bind_int64( statement, %d, "
+                            "row->%s );\n", param, c->name );
+                    break;
+
+                case COL_REAL:
+                    fprintf( out, "    sqlite3_bind_double( statement, %d, "
+                            "row->%s );\n", param, c->name );
+                    break;
+
+                case COL_TEXT:
+                    fprintf( out, "    sqlite3_bind_text( statement, %d, "
+                            "row->%s, -1, SQLITE_STATIC );\n", param, c->name );
+                    break;
+
+                case COL_BLOB:
+                    fprintf( out, "    sqlite3_bind_blob( statement, %d, "
+                            "row->%s, row->%sLen, SQLITE_STATIC );\n", param,
+                            c->name, c->name );
+                    break;
+            }
+            param++;
+        }
+
+        fprintf( out, "\n    rc = DBStepStatement( db, statement );\n\n"
+                "    if ( rc == SQLITE_DONE && rowid != NULL )\n"
+                "        *rowid = sqlite3_last_insert_rowid( "
+                "sqlite3_db_handle( statement ) );\n\n"
+                "    DBReleaseStatement( statement );\n\n"
+                "    switch ( rc )\n    {\n"
+                "        case SQLITE_DONE:\n            return DB_SUCCESS;\n\n"
+                "        case SQLITE_CONSTRAINT:\n"
+                "            return DB_ALREADY_EXISTS;\n\n"
+                "        default:\n            return DB_INTERNAL_ERROR;\n"
+                "    }\n}\n" );
+
+        /* Get */
+        fprintf( out, "\nDB_ERR\nDBget" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( databaseADT db, sqlite3_int64 rowid, "
+                "%sCallbackT fn,\n        void *ctx )\n{\n"
+                "    sqlite3_stmt *statement;\n    %s_t row;\n"
+                "    DB_ERR err;\n    int rc;\n\n"
+                "    if ( fn == NULL )\n        return DB_INVALID_ARG;\n\n"
+                "    if ( ( err = DBPrepareCached( db, %sGetSql, "
+                "&statement ) ) != DB_SUCCESS )\n        return err;\n\n"
+                "    sqlite3_bind_int64( statement, 1, rowid );\n\n"
+                "    if ( ( rc = DBStepStatement( db, statement ) ) == "
+                "SQLITE_ROW )\n    {\n"
+                "        read%c%s( statement, &row );\n"
+                "        fn( &row, ctx );\n    }\n\n"
+                "    DBReleaseStatement( statement );\n\n"
+                "    if ( rc == SQLITE_ROW )\n        return DB_SUCCESS;\n\n"
+                "    return ( rc == SQLITE_DONE ) ? DB_NO_MATCH : "
+                "DB_INTERNAL_ERROR;\n}\n",
+                t->name, t->name, t->name,
+                toupper( (unsigned char) t->name[0] ), t->name + 1 );
+
+        /* Iterate */
+        fprintf( out, "\nDB_ERR\nDBforEach" );
+        writeCapitalized( out, t->name );
+        fprintf( out, "( databaseADT db, %sCallbackT fn, void *ctx )\n{\n"
+                "    sqlite3_stmt *statement;\n    %s_t row;\n"
+                "    DB_ERR err;\n    int rc;\n\n"
+                "    if ( fn == NULL )\n        return DB_INVALID_ARG;\n\n"
+                "    if ( ( err = DBPrepareCached( db, %sSelectSql, "
+                "&statement ) ) != DB_SUCCESS )\n        return err;\n\n"
+                "    while ( ( rc = DBStepStatement( db, statement ) ) == "
+                "SQLITE_ROW )\n    {\n"
+                "        read%c%s( statement, &row );\n\n"
+                "        if ( fn( &row, ctx ) != 0 )\n"
+                "        {\n            rc = SQLITE_DONE;\n"
+                "            break;\n        }\n    }\n\n"
+                "    DBReleaseStatement( statement );\n\n"
+                "    return ( rc == SQLITE_DONE ) ? DB_SUCCESS : "
+                "DB_INTERNAL_ERROR;\n}\n",
+                t->name, t->name, t->name,
+                toupper( (unsigned char) t->name[0] ), t->name + 1 );
+    }
+}
+
+int
+main( int argc, char *argv[] )
+{
+    static table_t tables[MAX_TABLES];
+    char *schema, *path;
+    FILE *fp;
+    long size;
+    int n = 0;
+
+    if ( argc < 3 || argc > 5 )
+    {
+        fprintf( stderr, "Usage: %s schema.sql outName "
+                "[sqliteHeader [adtHeader]]\n", argv[0] );
+        return 1;
+    }
+
+    if ( ( fp = fopen( argv[1], "r" ) ) == NULL )
+    {
+        fprintf( stderr, "%s couldn't be opened\n", argv[1] );
+        return 1;
+    }
+
+    fseek( fp, 0, SEEK_END );
+    size = ftell( fp );
+    rewind( fp );
+
+    if ( ( schema = calloc( size + 1, 1 ) ) == NULL
+            || fread( schema, 1, size, fp ) != (size_t) size )
+    {
+        fprintf( stderr, "%s couldn't be read\n", argv[1] );
+        return 1;
+    }
+
+    fclose( fp );
+    src = schema;
+
+    while ( nextToken() )
+    {
+        if ( !isWord( "CREATE" ) )
+            continue;
+
+        nextToken();
+
+        if ( isWord( "TEMP" ) || isWord( "TEMPORARY" ) )
+            nextToken();
+
+        if ( !isWord( "TABLE" ) )
+            continue;
+
+        if ( n == MAX_TABLES || !parseTable( &tables[n] ) )
+        {
+            fprintf( stderr, "%s: can't parse table %s\n", argv[1], token );
+            return 1;
+        }
+
+        n++;
+    }
+
+    if ( ( path = malloc( strlen( argv[2] ) + 3 ) ) == NULL )
+        return 1;
+
+    sprintf( path, "%s.h", argv[2] );
+    if ( ( fp = fopen( path, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "%s couldn't be created\n", path );
+        return 1;
+    }
+    writeHeader( fp, strrchr( argv[2], '/' ) ? strrchr( argv[2], '/' ) + 1
+                : argv[2], ( argc >= 4 ) ? argv[3] : "sqlite3.h",
+                ( argc == 5 ) ? argv[4] : "databaseADT.h", tables, n );
+    fclose( fp );
+
+    sprintf( path, "%s.c", argv[2] );
+    if ( ( fp = fopen( path, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "%s couldn't be created\n", path );
+        return 1;
+    }
+    writeSource( fp, strrchr( argv[2], '/' ) ? strrchr( argv[2], '/' ) + 1
+                : argv[2], tables, n );
+    fclose( fp );
+
+    free( path );
+    free( schema );
+
+    return 0;
+}